@@ -10,23 +10,389 @@
  */
 #include "blink.h"
 
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
 #include <zephyr/drivers/hwinfo.h>
+#include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/sys/crc.h>
 
 #include "../lib/fn.h"
+#include "slot_image.h"
 #include "storage.h"
 
 LOG_MODULE_REGISTER(app_blink, LOG_LEVEL_DBG);
 
+/**
+ * @brief Settings of each slot, indexed from kBlinkSlot1
+ * @details Only the first BLINK_SLOT_COUNT entries are used. Lower priority
+ * values run first, and heap shares are relative to each other. The slot
+ * chosen by CONFIG_OPENBLINK_ISOLATED_SLOT is isolated; its programs must
+ * define nothing global.
+ */
+static const blink_slot_config_t blink_slot_table[] = {
+    {.storage_id = kStorageBlinkSlot1,
+     .priority = 1,
+     .autostart = true,
+     .heap_share = 1,
+     .isolated = (1 == CONFIG_OPENBLINK_ISOLATED_SLOT)},
+    {.storage_id = kStorageBlinkSlot2,
+     .priority = 2,
+     .autostart = true,
+     .heap_share = 1,
+     .isolated = (2 == CONFIG_OPENBLINK_ISOLATED_SLOT)},
+    {.storage_id = kStorageBlinkSlot3,
+     .priority = 3,
+     .autostart = true,
+     .heap_share = 1,
+     .isolated = (3 == CONFIG_OPENBLINK_ISOLATED_SLOT)},
+    {.storage_id = kStorageBlinkSlot4,
+     .priority = 4,
+     .autostart = true,
+     .heap_share = 1,
+     .isolated = (4 == CONFIG_OPENBLINK_ISOLATED_SLOT)},
+    {.storage_id = kStorageBlinkSlot5,
+     .priority = 5,
+     .autostart = true,
+     .heap_share = 1,
+     .isolated = (5 == CONFIG_OPENBLINK_ISOLATED_SLOT)},
+};
+
+BUILD_ASSERT(BLINK_SLOT_COUNT <= ARRAY_SIZE(blink_slot_table),
+             "blink_slot_table is shorter than CONFIG_OPENBLINK_SLOT_COUNT");
+
+/**
+ * @brief Distance between the storage IDs of consecutive records of a slot
+ * @details The first record of the first chain uses the storage ID of the
+ * slot itself, so bytecode stored as a single record stays readable
+ */
+#define BLINK_RECORD_ID_STRIDE (0x100U)
+
+/**
+ * @brief Storage ID offset of the second record chain of a slot
+ * @details A store writes the chain that is not current, so the previous
+ * bytecode stays intact until the new one is complete
+ */
+#define BLINK_RECORD_ID_CHAIN (0x80U)
+
+/**
+ * @brief Storage ID offset of the record naming the current chain of a slot
+ * @details Holds one byte, the index of the current chain. Without it the
+ * first chain is current, as written by older firmware.
+ */
+#define BLINK_RECORD_ID_HEAD (0x40U)
+
+/** @brief Number of record chains of a slot */
+#define BLINK_RECORD_CHAIN_COUNT (2U)
+
+/**
+ * @brief Mutex for the stored bytecode of the slots
+ * @details Held by the public slot functions across every record_*() call
+ * and the CRC16 cache update, so the VM thread never reads a chain that the
+ * BT RX thread is switching or deleting, and two stores never pick the same
+ * new chain. Also guards record_page.
+ */
+static K_MUTEX_DEFINE(blink_slot_mutex);
+
 /**
  * @brief Converts a blink slot to a storage ID
  *
- * @param kSlot The blink slot to convert
+ * @param kSlot The blink slot to convert, which must be valid
  * @return storage_id_t The corresponding storage ID
  */
 static storage_id_t slot_to_storageid(const blink_slot_t kSlot);
 
+/**
+ * @brief Gets the current record chain of a slot
+ *
+ * @param kSlot The slot, which must be valid
+ * @return uint8_t Index of the current chain
+ */
+static uint8_t record_chain(const blink_slot_t kSlot) {
+  uint8_t chain = 0;
+  const storage_id_t kHead =
+      (storage_id_t)(slot_to_storageid(kSlot) + BLINK_RECORD_ID_HEAD);
+  if ((sizeof(chain) != storage_read(kHead, &chain, sizeof(chain))) ||
+      (BLINK_RECORD_CHAIN_COUNT <= chain)) {
+    chain = 0;
+  }
+  return chain;
+}
+
+/**
+ * @brief Gets the storage ID of a record of a slot
+ *
+ * @param kSlot The slot, which must be valid
+ * @param kChain Index of the record chain
+ * @param kRecord Record index, 0 for the first record
+ * @return storage_id_t Storage ID of the record
+ */
+static storage_id_t record_id(const blink_slot_t kSlot, const uint8_t kChain,
+                              const size_t kRecord) {
+  return (storage_id_t)(slot_to_storageid(kSlot) +
+                        (kChain * BLINK_RECORD_ID_CHAIN) +
+                        (kRecord * BLINK_RECORD_ID_STRIDE));
+}
+
+/**
+ * @brief Reads the records of a slot from ZMS
+ *
+ * @details Every record but the last holds at least BLINK_RECORD_SIZE bytes,
+ * more if older firmware wrote it, so a shorter or missing record ends the
+ * bytecode. Like a single ZMS read, the stored length is returned even if
+ * the buffer is too small to hold it.
+ *
+ * @param kSlot The slot to read, which must be valid
+ * @param data Buffer to store the bytecode, NULL to only get the length
+ * @param kLength Maximum length of the buffer
+ * @return ssize_t Length of the bytecode, -ENOENT if the slot is empty, or
+ * negative on error
+ */
+static ssize_t record_read(const blink_slot_t kSlot, uint8_t* const data,
+                           const size_t kLength) {
+  const uint8_t kChain = record_chain(kSlot);
+  size_t total = 0;
+  for (size_t i = 0; i < BLINK_RECORD_COUNT; i++) {
+    const storage_id_t kId = record_id(kSlot, kChain, i);
+    const ssize_t kSize = storage_get_data_length(kId);
+    if (0 > kSize) {
+      // Only a missing first record means the slot is empty
+      return ((-ENOENT == kSize) && (0 < i)) ? (ssize_t)total : kSize;
+    }
+    if ((NULL != data) && (total + (size_t)kSize <= kLength)) {
+      const ssize_t kRc = storage_read(kId, &data[total], (size_t)kSize);
+      if (kSize != kRc) {
+        return (0 > kRc) ? kRc : -EIO;
+      }
+    }
+    total += (size_t)kSize;
+    if (BLINK_RECORD_SIZE > kSize) {
+      break;
+    }
+  }
+  return (ssize_t)total;
+}
+
+/** @brief Buffer for reads that start inside a record */
+static uint8_t record_page[BLINK_RECORD_SIZE];
+
+/**
+ * @brief Reads part of the records of a slot from ZMS
+ *
+ * @details A ZMS read starts at the beginning of a record, so a read that
+ * starts inside a record goes through record_page. The caller holds
+ * blink_slot_mutex. Records written by older
+ * firmware may be larger than that; reading inside them fails until
+ * blink_load() has converted the slot.
+ *
+ * @param kSlot The slot to read, which must be valid
+ * @param kOffset Offset in the bytecode to start reading from
+ * @param data Buffer to store the bytecode
+ * @param kLength Number of bytes to read at most
+ * @return ssize_t The number of bytes read, -ENOENT if the slot is empty,
+ * -EFBIG if the read starts inside an old large record, or negative on error
+ */
+static ssize_t record_read_at(const blink_slot_t kSlot, const size_t kOffset,
+                              uint8_t* const data, const size_t kLength) {
+  const uint8_t kChain = record_chain(kSlot);
+  size_t start = 0;
+  size_t done = 0;
+  for (size_t i = 0; (i < BLINK_RECORD_COUNT) && (done < kLength); i++) {
+    const storage_id_t kId = record_id(kSlot, kChain, i);
+    const ssize_t kSize = storage_get_data_length(kId);
+    if (0 > kSize) {
+      return ((-ENOENT == kSize) && (0 < i)) ? (ssize_t)done : kSize;
+    }
+    const size_t kEnd = start + (size_t)kSize;
+    if (kOffset + done < kEnd) {
+      const size_t kSkip = kOffset + done - start;
+      const size_t kCount = MIN(kEnd - (kOffset + done), kLength - done);
+      ssize_t rc = 0;
+      if (0 == kSkip) {
+        rc = storage_read(kId, &data[done], kCount);
+      } else if (kSkip + kCount <= sizeof(record_page)) {
+        rc = storage_read(kId, record_page, kSkip + kCount);
+        memcpy(&data[done], &record_page[kSkip], kCount);
+        rc = (0 > rc) ? rc : (rc - (ssize_t)kSkip);
+      } else {
+        return -EFBIG;
+      }
+      if ((ssize_t)kCount != rc) {
+        return (0 > rc) ? rc : -EIO;
+      }
+      done += kCount;
+    }
+    start = kEnd;
+    if (BLINK_RECORD_SIZE > kSize) {
+      break;
+    }
+  }
+  return (ssize_t)done;
+}
+
+/**
+ * @brief Checks whether a slot was stored as one record by older firmware
+ *
+ * @param kSlot The slot to check, which must be valid
+ * @return true if the first record is larger than BLINK_RECORD_SIZE
+ */
+static bool record_is_large(const blink_slot_t kSlot) {
+  return BLINK_RECORD_SIZE <
+         storage_get_data_length(record_id(kSlot, record_chain(kSlot), 0));
+}
+
+/**
+ * @brief Deletes the records of one chain of a slot from ZMS
+ *
+ * @param kSlot The slot, which must be valid
+ * @param kChain Index of the record chain
+ * @return int 0 on success, negative on the first error
+ */
+static int record_delete_chain(const blink_slot_t kSlot, const uint8_t kChain) {
+  int rc = 0;
+  for (size_t i = 0; i < BLINK_RECORD_COUNT; i++) {
+    const int kRc = storage_delete(record_id(kSlot, kChain, i));
+    rc = (0 == rc) ? kRc : rc;
+  }
+  return rc;
+}
+
+/**
+ * @brief Deletes every record of a slot from ZMS
+ *
+ * @details The first record of the current chain goes first, so the slot
+ * reads as empty even if the deletion is interrupted
+ *
+ * @param kSlot The slot to delete, which must be valid
+ * @return int 0 on success, negative on the first error
+ */
+static int record_delete(const blink_slot_t kSlot) {
+  int rc = storage_delete(record_id(kSlot, record_chain(kSlot), 0));
+  for (uint8_t chain = 0; chain < BLINK_RECORD_CHAIN_COUNT; chain++) {
+    const int kRc = record_delete_chain(kSlot, chain);
+    rc = (0 == rc) ? kRc : rc;
+  }
+  const int kRc = storage_delete(
+      (storage_id_t)(slot_to_storageid(kSlot) + BLINK_RECORD_ID_HEAD));
+  return (0 == rc) ? kRc : rc;
+}
+
+/**
+ * @brief Writes bytecode to a slot as ZMS records
+ *
+ * @details The records are written to the chain that is not current, and
+ * the head record is switched to it only once the last record is written.
+ * The old chain is deleted after that, so a failed write or a power loss
+ * leaves the previous bytecode in place.
+ *
+ * @param kSlot The slot to write, which must be valid
+ * @param kData Pointer to the bytecode data
+ * @param kLength Length of the bytecode data
+ * @return ssize_t The number of bytes written, or negative on error
+ */
+static ssize_t record_write(const blink_slot_t kSlot,
+                            const uint8_t* const kData, const size_t kLength) {
+  if (BLINK_MAX_BYTECODE_SIZE < kLength) {
+    return -EINVAL;
+  }
+  const uint8_t kOld = record_chain(kSlot);
+  const uint8_t kNew = (kOld + 1U) % BLINK_RECORD_CHAIN_COUNT;
+
+  // Leftovers of an interrupted write
+  record_delete_chain(kSlot, kNew);
+  for (size_t offset = 0, i = 0; offset < kLength; i++) {
+    const size_t kSize = MIN(kLength - offset, BLINK_RECORD_SIZE);
+    const ssize_t kRc =
+        storage_write(record_id(kSlot, kNew, i), &kData[offset], kSize);
+    if (0 > kRc) {
+      record_delete_chain(kSlot, kNew);
+      return kRc;
+    }
+    offset += kSize;
+  }
+
+  const ssize_t kRc = storage_write(
+      (storage_id_t)(slot_to_storageid(kSlot) + BLINK_RECORD_ID_HEAD), &kNew,
+      sizeof(kNew));
+  if (0 > kRc) {
+    record_delete_chain(kSlot, kNew);
+    return kRc;
+  }
+  record_delete_chain(kSlot, kOld);
+  return (ssize_t)kLength;
+}
+
+/**
+ * @brief CRC16 of the stored bytecode of each slot
+ * @details Learned when a slot is loaded, stored or deleted, so the bytecode
+ * is never read only to compute it
+ */
+static struct {
+  bool known;   /**< true if crc is valid */
+  uint16_t crc; /**< CRC16 of the stored bytecode */
+} blink_crc[BLINK_SLOT_COUNT];
+
+/** @brief Callback for CRC16 changes */
+static blink_crc_cb_t blink_crc_cb = NULL;
+
+/**
+ * @brief Records a CRC16 of the stored bytecode of a slot
+ *
+ * @param kSlot The slot, which must be valid
+ * @param kCrc CRC16 of the stored bytecode
+ */
+static void blink_set_crc(const blink_slot_t kSlot, const uint16_t kCrc) {
+  const size_t kIndex = kSlot - kBlinkSlot1;
+  const bool kChanged =
+      !blink_crc[kIndex].known || (kCrc != blink_crc[kIndex].crc);
+  blink_crc[kIndex].known = true;
+  blink_crc[kIndex].crc = kCrc;
+  if (kChanged && (NULL != blink_crc_cb)) {
+    blink_crc_cb(kSlot, kCrc);
+  }
+}
+
+/**
+ * @brief Records the CRC16 of the stored bytecode of a slot
+ *
+ * @param kSlot The slot that was loaded, stored or deleted
+ * @param kData Pointer to the stored bytecode, NULL if the slot is empty
+ * @param kLength Length of the stored bytecode
+ */
+static void blink_update_crc(const blink_slot_t kSlot, const void* const kData,
+                             const size_t kLength) {
+  if (!blink_slot_is_valid(kSlot)) {
+    return;
+  }
+  blink_set_crc(kSlot, (NULL == kData)
+                           ? BLINK_EMPTY_CRC
+                           : crc16_reflect(0xd175U, 0xFFFFU, kData, kLength));
+}
+
+/**
+ * @brief Checks that a slot number is within the configured slots
+ *
+ * @param kSlot The slot to check
+ * @return true if the slot exists
+ */
+bool blink_slot_is_valid(const blink_slot_t kSlot) {
+  return (kBlinkSlot1 <= kSlot) && (BLINK_SLOT_COUNT >= kSlot);
+}
+
+/**
+ * @brief Gets the build-time settings of a slot
+ *
+ * @param kSlot The slot to look up
+ * @return const blink_slot_config_t* Settings, NULL if the slot does not exist
+ */
+const blink_slot_config_t* blink_get_slot_config(const blink_slot_t kSlot) {
+  if (!blink_slot_is_valid(kSlot)) {
+    return NULL;
+  }
+  return &blink_slot_table[kSlot - kBlinkSlot1];
+}
+
 /**
  * @brief Gets the device name with unique identifier
  *
@@ -52,6 +418,12 @@ void blink_get_name(char* const name, const size_t kBufSize) {
 /**
  * @brief Loads bytecode from the specified slot
  *
+ * @details Reads the slot partition if CONFIG_OPENBLINK_SLOT_XIP is set, and
+ * the ZMS records of the slot otherwise. The other slot functions choose the
+ * backend the same way. Bytecode stored by older firmware as one large
+ * record is written again as records of BLINK_RECORD_SIZE, so that parts of
+ * it can be read with blink_read().
+ *
  * @param kSlot The slot to load from
  * @param data Buffer to store the bytecode
  * @param kLength Maximum length of the buffer
@@ -59,12 +431,100 @@ void blink_get_name(char* const name, const size_t kBufSize) {
  */
 ssize_t blink_load(const blink_slot_t kSlot, void* const data,
                    const size_t kLength) {
-  return storage_read(slot_to_storageid(kSlot), data, kLength);
+  if (!blink_slot_is_valid(kSlot)) {
+    return -EINVAL;
+  }
+  k_mutex_lock(&blink_slot_mutex, K_FOREVER);
+  const ssize_t kRc =
+      IS_ENABLED(CONFIG_OPENBLINK_SLOT_XIP)
+          ? slot_image_read(kSlot, 0, data, kLength)
+          : record_read(kSlot, data, kLength);
+  if ((0 < kRc) && (kLength >= (size_t)kRc)) {
+    blink_update_crc(kSlot, data, (size_t)kRc);
+    if (!IS_ENABLED(CONFIG_OPENBLINK_SLOT_XIP) && record_is_large(kSlot)) {
+      LOG_INF("Slot %d converted to records of %d bytes", kSlot,
+              BLINK_RECORD_SIZE);
+      record_write(kSlot, data, (size_t)kRc);
+    }
+  }
+  k_mutex_unlock(&blink_slot_mutex);
+  return kRc;
+}
+
+/**
+ * @brief Reads part of the bytecode of the specified slot
+ *
+ * @param kSlot The slot to read from
+ * @param kOffset Offset in the bytecode to start reading from
+ * @param data Buffer to store the bytecode
+ * @param kLength Number of bytes to read at most
+ * @return ssize_t The number of bytes read, 0 at or past the end, -ENOENT if
+ * the slot is empty, or negative on error
+ */
+ssize_t blink_read(const blink_slot_t kSlot, const size_t kOffset,
+                   void* const data, const size_t kLength) {
+  if (!blink_slot_is_valid(kSlot)) {
+    return -EINVAL;
+  }
+  if (!IS_ENABLED(CONFIG_OPENBLINK_SLOT_XIP)) {
+    k_mutex_lock(&blink_slot_mutex, K_FOREVER);
+    const ssize_t kRc = record_read_at(kSlot, kOffset, data, kLength);
+    k_mutex_unlock(&blink_slot_mutex);
+    return kRc;
+  }
+  const ssize_t kRc = slot_image_read(kSlot, kOffset, data, kLength);
+  if (0 > kRc) {
+    return kRc;
+  }
+  return ((size_t)kRc > kOffset) ? (ssize_t)MIN(kLength, kRc - kOffset) : 0;
+}
+
+/**
+ * @brief Gets the CRC16 of the bytecode of the specified slot
+ *
+ * @details The CRC16 learned when the slot was last loaded, stored or
+ * deleted is returned at once. Otherwise it is computed from the stored
+ * bytecode in small parts, so no buffer for the whole bytecode is needed.
+ *
+ * @param kSlot The slot to check
+ * @param crc Set to the CRC16, BLINK_EMPTY_CRC if the slot is empty
+ * @return int 0 on success, negative on error
+ */
+int blink_get_crc(const blink_slot_t kSlot, uint16_t* const crc) {
+  if (!blink_slot_is_valid(kSlot)) {
+    return -EINVAL;
+  }
+  const size_t kIndex = kSlot - kBlinkSlot1;
+  k_mutex_lock(&blink_slot_mutex, K_FOREVER);
+  if (!blink_crc[kIndex].known) {
+    uint8_t chunk[64];
+    uint16_t value = 0xFFFFU;
+    ssize_t rc = 0;
+    for (size_t offset = 0;; offset += (size_t)rc) {
+      rc = blink_read(kSlot, offset, chunk, sizeof(chunk));
+      if (0 >= rc) {
+        break;
+      }
+      value = crc16_reflect(0xd175U, value, chunk, (size_t)rc);
+    }
+    if (-ENOENT == rc) {
+      value = BLINK_EMPTY_CRC;
+    } else if (0 > rc) {
+      k_mutex_unlock(&blink_slot_mutex);
+      return (int)rc;
+    }
+    blink_set_crc(kSlot, value);
+  }
+  *crc = blink_crc[kIndex].crc;
+  k_mutex_unlock(&blink_slot_mutex);
+  return 0;
 }
 
 /**
  * @brief Stores bytecode to the specified slot
  *
+ * @details Records in ZMS also refresh the free space reported in the status
+ *
  * @param kSlot The slot to store to
  * @param kData Pointer to the bytecode data
  * @param kLength Length of the bytecode data
@@ -72,8 +532,34 @@ ssize_t blink_load(const blink_slot_t kSlot, void* const data,
  */
 ssize_t blink_store(const blink_slot_t kSlot, const void* const kData,
                     const size_t kLength) {
-  storage_delete(slot_to_storageid(kSlot));
-  return storage_write(slot_to_storageid(kSlot), kData, kLength);
+  if (!blink_slot_is_valid(kSlot)) {
+    return -EINVAL;
+  }
+  k_mutex_lock(&blink_slot_mutex, K_FOREVER);
+  if (IS_ENABLED(CONFIG_OPENBLINK_SLOT_XIP)) {
+    const ssize_t kRc = slot_image_write(kSlot, kData, kLength);
+    if (0 <= kRc) {
+      blink_update_crc(kSlot, kData, kLength);
+    } else {
+      // A failed store keeps the bytecode of the other bank; its CRC16 is
+      // the cached one unless the VM still ran an older program
+      uint16_t crc = BLINK_EMPTY_CRC;
+      const int kErr = slot_image_get_crc(kSlot, &crc);
+      if ((0 == kErr) || (-ENOENT == kErr)) {
+        blink_set_crc(kSlot, crc);
+      }
+    }
+    k_mutex_unlock(&blink_slot_mutex);
+    return kRc;
+  }
+  const ssize_t kRc = record_write(kSlot, kData, kLength);
+  // A failed write keeps the previous bytecode and its CRC16
+  if (0 <= kRc) {
+    blink_update_crc(kSlot, kData, kLength);
+  }
+  k_mutex_unlock(&blink_slot_mutex);
+  storage_free_space();
+  return kRc;
 }
 
 /**
@@ -83,35 +569,93 @@ ssize_t blink_store(const blink_slot_t kSlot, const void* const kData,
  * @return ssize_t The length of the bytecode, or negative on error
  */
 ssize_t blink_get_data_length(const blink_slot_t kSlot) {
-  return storage_get_data_length(slot_to_storageid(kSlot));
+  if (!blink_slot_is_valid(kSlot)) {
+    return -EINVAL;
+  }
+  k_mutex_lock(&blink_slot_mutex, K_FOREVER);
+  const ssize_t kRc = IS_ENABLED(CONFIG_OPENBLINK_SLOT_XIP)
+                          ? slot_image_get_length(kSlot)
+                          : record_read(kSlot, NULL, 0);
+  if (-ENOENT == kRc) {
+    blink_update_crc(kSlot, NULL, 0);
+  }
+  k_mutex_unlock(&blink_slot_mutex);
+  return kRc;
 }
 
 /**
  * @brief Deletes bytecode from the specified slot
  *
+ * @details Records in ZMS also refresh the free space reported in the status
+ *
  * @param kSlot The slot to delete
  * @return int 0 on success, negative on error
  */
 int blink_delete(const blink_slot_t kSlot) {
-  return storage_delete(slot_to_storageid(kSlot));
+  if (!blink_slot_is_valid(kSlot)) {
+    return -EINVAL;
+  }
+  k_mutex_lock(&blink_slot_mutex, K_FOREVER);
+  const int kRc = IS_ENABLED(CONFIG_OPENBLINK_SLOT_XIP)
+                      ? slot_image_delete(kSlot)
+                      : record_delete(kSlot);
+  if (0 == kRc) {
+    blink_update_crc(kSlot, NULL, 0);
+  }
+  k_mutex_unlock(&blink_slot_mutex);
+  if (!IS_ENABLED(CONFIG_OPENBLINK_SLOT_XIP)) {
+    storage_free_space();
+  }
+  return kRc;
+}
+
+/**
+ * @brief Maps the stored bytecode of a slot for execution in place
+ *
+ * @details Only available with CONFIG_OPENBLINK_SLOT_XIP. The bytecode stays
+ * valid until the slot is mapped again, even if it is overwritten or deleted.
+ *
+ * @param kSlot The slot to map
+ * @param length Set to the length of the bytecode
+ * @return const uint8_t* Memory-mapped bytecode, NULL if the slot is empty or
+ * the option is not set
+ */
+const uint8_t* blink_map(const blink_slot_t kSlot, size_t* const length) {
+  *length = 0;
+  if (!IS_ENABLED(CONFIG_OPENBLINK_SLOT_XIP)) {
+    return NULL;
+  }
+  const uint8_t* const kBytecode = slot_image_map(kSlot, length);
+  blink_update_crc(kSlot, kBytecode, *length);
+  return kBytecode;
+}
+
+/**
+ * @brief Sets the callback for changes of the stored bytecode CRC16
+ *
+ * @details The callback is called at once for every slot whose CRC16 is
+ * already known.
+ *
+ * @param cb Callback function, NULL to remove it
+ */
+void blink_set_crc_callback(blink_crc_cb_t cb) {
+  blink_crc_cb = cb;
+  if (NULL == cb) {
+    return;
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(blink_crc); i++) {
+    if (blink_crc[i].known) {
+      cb((blink_slot_t)(kBlinkSlot1 + i), blink_crc[i].crc);
+    }
+  }
 }
 
 /**
  * @brief Converts a blink slot to a storage ID
  *
- * @param kSlot The blink slot to convert
+ * @param kSlot The blink slot to convert, which must be valid
  * @return storage_id_t The corresponding storage ID
  */
 static storage_id_t slot_to_storageid(const blink_slot_t kSlot) {
-  switch (kSlot) {
-    case kBlinkSlot1:
-      return kStorageBlinkSlot1;
-      break;
-    case kBlinkSlot2:
-      return kStorageBlinkSlot2;
-      break;
-    default:
-      return kStorageBlinkSlot1;
-      break;
-  }
+  return blink_slot_table[kSlot - kBlinkSlot1].storage_id;
 }
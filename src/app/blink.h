@@ -10,15 +10,32 @@
 #ifndef APP_BLINK_H
 #define APP_BLINK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include "storage.h"
+
 /**
  * @brief Maximum size of bytecode that can be stored
  */
-#define BLINK_MAX_BYTECODE_SIZE (4016)
+#define BLINK_MAX_BYTECODE_SIZE (CONFIG_OPENBLINK_MAX_BYTECODE_SIZE)
+
+/**
+ * @brief Size of one ZMS record of a slot
+ * @details Bytecode larger than this is stored as several records. Small
+ * records let a part of the bytecode be read through a buffer of this size,
+ * since a ZMS read always starts at the beginning of a record.
+ */
+#define BLINK_RECORD_SIZE (256)
+
+/**
+ * @brief Maximum number of ZMS records of a slot
+ */
+#define BLINK_RECORD_COUNT \
+  ((BLINK_MAX_BYTECODE_SIZE + BLINK_RECORD_SIZE - 1) / BLINK_RECORD_SIZE)
 
 /**
  * @brief Size of the device name buffer including BT device name, separator,
@@ -26,15 +43,66 @@
  */
 #define BLINK_DEVICE_NAME_SIZE (sizeof(CONFIG_BT_DEVICE_NAME) + 1 + 4 + 1)
 
+/**
+ * @brief CRC16 of an empty slot, which is the CRC16 of no data
+ */
+#define BLINK_EMPTY_CRC (0xFFFFU)
+
+/**
+ * @brief Number of bytecode slots
+ */
+#define BLINK_SLOT_COUNT (CONFIG_OPENBLINK_SLOT_COUNT)
+
 /**
  * @typedef blink_slot_t
  * @brief Enumeration of bytecode storage slots
+ * @details Slots are numbered from kBlinkSlot1 up to BLINK_SLOT_COUNT; the
+ * named slots are the ones with a factory default program.
  */
 typedef enum {
   kBlinkSlot1 = 1U, /**< First bytecode slot */
   kBlinkSlot2 = 2U, /**< Second bytecode slot */
 } blink_slot_t;
 
+/**
+ * @typedef blink_slot_config_t
+ * @brief Build-time settings of a bytecode slot
+ */
+typedef struct {
+  storage_id_t storage_id; /**< ZMS ID holding the bytecode */
+  uint8_t priority;        /**< Task priority, lower runs first */
+  bool autostart;          /**< true to start the task when the VM starts */
+  /** Share of the VM heap, relative to the shares of all slots */
+  uint8_t heap_share;
+  /**
+   * true if its programs define no classes, methods, constants or global
+   * variables, so the slot can be reloaded while the other tasks run
+   */
+  bool isolated;
+} blink_slot_config_t;
+
+/**
+ * @typedef blink_crc_cb_t
+ * @brief Callback for a changed CRC16 of the stored bytecode of a slot
+ */
+typedef void (*blink_crc_cb_t)(const blink_slot_t kSlot, const uint16_t kCrc);
+
+/**
+ * @brief Checks that a slot number is within the configured slots
+ *
+ * @param kSlot The slot to check
+ * @return true if the slot exists
+ */
+bool blink_slot_is_valid(const blink_slot_t kSlot);
+
+/**
+ * @brief Gets the build-time settings of a slot
+ *
+ * @param kSlot The slot to look up
+ * @return const blink_slot_config_t* Settings, NULL if the slot does not exist
+ */
+const blink_slot_config_t *blink_get_slot_config(const blink_slot_t kSlot);
+
 /**
  * @brief Gets the device name with unique identifier
  *
@@ -54,6 +122,28 @@ void blink_get_name(char *const name, const size_t kBufSize);
 ssize_t blink_load(const blink_slot_t kSlot, void *const data,
                    const size_t kLength);
 
+/**
+ * @brief Reads part of the bytecode of the specified slot
+ *
+ * @param kSlot The slot to read from
+ * @param kOffset Offset in the bytecode to start reading from
+ * @param data Buffer to store the bytecode
+ * @param kLength Number of bytes to read at most
+ * @return ssize_t The number of bytes read, 0 at or past the end, -ENOENT if
+ * the slot is empty, or negative on error
+ */
+ssize_t blink_read(const blink_slot_t kSlot, const size_t kOffset,
+                   void *const data, const size_t kLength);
+
+/**
+ * @brief Gets the CRC16 of the bytecode of the specified slot
+ *
+ * @param kSlot The slot to check
+ * @param crc Set to the CRC16, BLINK_EMPTY_CRC if the slot is empty
+ * @return int 0 on success, negative on error
+ */
+int blink_get_crc(const blink_slot_t kSlot, uint16_t *const crc);
+
 /**
  * @brief Stores bytecode to the specified slot
  *
@@ -81,4 +171,27 @@ ssize_t blink_get_data_length(const blink_slot_t kSlot);
  */
 int blink_delete(const blink_slot_t kSlot);
 
+/**
+ * @brief Maps the stored bytecode of a slot for execution in place
+ *
+ * @details Only available with CONFIG_OPENBLINK_SLOT_XIP. The bytecode stays
+ * valid until the slot is mapped again, even if it is overwritten or deleted.
+ *
+ * @param kSlot The slot to map
+ * @param length Set to the length of the bytecode
+ * @return const uint8_t* Memory-mapped bytecode, NULL if the slot is empty or
+ * the option is not set
+ */
+const uint8_t *blink_map(const blink_slot_t kSlot, size_t *const length);
+
+/**
+ * @brief Sets the callback for changes of the stored bytecode CRC16
+ *
+ * @details The callback is called at once for every slot whose CRC16 is
+ * already known.
+ *
+ * @param cb Callback function, NULL to remove it
+ */
+void blink_set_crc_callback(blink_crc_cb_t cb);
+
 #endif
@@ -9,6 +9,7 @@
  */
 #include "comm.h"
 
+#include <errno.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -17,6 +18,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/drivers/hwinfo.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 
@@ -26,6 +28,8 @@
 #include "blink.h"
 #include "init.h"
 #include "mrubyc_vm.h"
+#include "profiler.h"
+#include "storage.h"
 
 LOG_MODULE_REGISTER(app_comm, LOG_LEVEL_DBG);
 
@@ -35,6 +39,76 @@ static volatile bool advertising = false;
 /** @brief Flag indicating if BLE is connected to a device */
 static volatile bool connected = false;
 
+/**
+ * @brief Fills the device status snapshot
+ *
+ * @param param BLE event parameters to fill
+ */
+static void comm_status(BLE_PARAM* param) {
+  BUILD_ASSERT(BLE_STATUS_SLOT_COUNT == MRUBYC_VM_SLOT_COUNT);
+  mrubyc_vm_status_t vm = {0};
+  app_mrubyc_vm_get_status(&vm);
+  param->status.vm_state = (uint8_t)vm.state;
+  param->status.vm_restarts = vm.restarts;
+  param->status.heap_used = vm.heap_used;
+  param->status.heap_free = vm.heap_free;
+  param->status.heap_peak = vm.heap_peak;
+  param->status.stack_peak = vm.stack_peak;
+  param->status.stack_size = vm.stack_size;
+  for (size_t i = 0; i < BLE_STATUS_SLOT_COUNT; i++) {
+    param->status.slot_length[i] = vm.slots[i].length;
+    param->status.slot_crc[i] = vm.slots[i].crc;
+  }
+
+  const ssize_t kFree = storage_get_free_space();
+  param->status.storage_free = (0 < kFree) ? (uint32_t)kFree : 0U;
+  param->status.uptime = (uint32_t)(k_uptime_get() / MSEC_PER_SEC);
+
+  uint32_t reset_cause = 0x00U;
+  if (0 == hwinfo_get_reset_cause(&reset_cause)) {
+    param->status.reset_cause = reset_cause;
+  }
+}
+
+/**
+ * @brief Reads part of the stored bytecode, or its length and CRC16
+ *
+ * @param param BLE event parameters to fill
+ * @return int 0 on success, negative on error
+ */
+static int comm_slot_read(BLE_PARAM* param) {
+  const blink_slot_t kSlot = (blink_slot_t)(param->slot_read.slot);
+  if (NULL != param->slot_read.buffer) {
+    param->slot_read.length =
+        blink_read(kSlot, param->slot_read.offset, param->slot_read.buffer,
+                   param->slot_read.size);
+  } else {
+    ssize_t length = blink_get_data_length(kSlot);
+    uint16_t crc = BLINK_EMPTY_CRC;
+    if ((0 <= length) || (-ENOENT == length)) {
+      const int kRc = blink_get_crc(kSlot, &crc);
+      length = (0 == kRc) ? length : kRc;
+    }
+    param->slot_read.length = length;
+    param->slot_read.crc = crc;
+  }
+  if ((0 > param->slot_read.length) && (-ENOENT != param->slot_read.length)) {
+    LOG_ERR("COMM: Slot %d read error %d", kSlot, param->slot_read.length);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Advertises a changed CRC16 of the stored bytecode
+ *
+ * @param kSlot Slot whose bytecode changed
+ * @param kCrc CRC16 of the stored bytecode
+ */
+static void comm_crc_changed(const blink_slot_t kSlot, const uint16_t kCrc) {
+  ble_set_slot_crc((uint8_t)kSlot, kCrc);
+}
+
 /**
  * @brief BLE event callback function
  *
@@ -49,15 +123,16 @@ static int ble_event_cb(BLE_PARAM* param) {
       break;
 
     case BLE_EVENT_CONNECTED:
-      LOG_DBG("COMM: Connected");
+      LOG_DBG("COMM: Connected (%d)", param->connected.count);
       connected = true;
       advertising = false;
       break;
 
     case BLE_EVENT_DISCONNECTED:
-      LOG_DBG("COMM: Disconnected (%d)", param->disconnected.reason);
-      connected = false;
-      advertising = true;
+      LOG_DBG("COMM: Disconnected (%d), %d left", param->disconnected.reason,
+              param->disconnected.count);
+      connected = (0 < param->disconnected.count);
+      advertising = !connected;
       break;
 
     case BLE_EVENT_RECEIVED:
@@ -85,12 +160,38 @@ static int ble_event_cb(BLE_PARAM* param) {
       break;
 
     case BLE_EVENT_STATUS:
-      param->status.mtu = ble_get_mtu();
+      comm_status(param);
+      break;
+
+    case BLE_EVENT_SLOT_READ:
+      err = comm_slot_read(param);
       break;
 
     case BLE_EVENT_RELOAD:
-      LOG_DBG("COMM:Reloading ...");
-      app_mrubyc_vm_restart();
+      if (0 == param->reload.slot) {
+        LOG_DBG("COMM:Reloading ...");
+        app_mrubyc_vm_restart();
+      } else {
+        LOG_DBG("COMM:Reloading slot %d ...", param->reload.slot);
+        if (kSuccess !=
+            app_mrubyc_vm_reload_slot((blink_slot_t)(param->reload.slot))) {
+          err = -1;
+        }
+      }
+      break;
+
+    case BLE_EVENT_PROFILE:
+      if (BLE_PROFILE_START == param->profile.action) {
+        LOG_DBG("COMM: Profiler start (%d ms)", param->profile.interval);
+        profiler_start(param->profile.interval);
+      } else if (BLE_PROFILE_STOP == param->profile.action) {
+        LOG_DBG("COMM: Profiler stop");
+        profiler_stop();
+      } else {
+        param->profile.length =
+            profiler_read(param->profile.first, param->profile.buffer,
+                          param->profile.size);
+      }
       break;
 
     case BLE_EVENT_REBOOT:
@@ -117,6 +218,7 @@ fn_t comm_init(void) {
   char device_name[BLINK_DEVICE_NAME_SIZE] = {0};
 
   ble_init(ble_event_cb);
+  blink_set_crc_callback(comm_crc_changed);
 
   // Set Device Name
   blink_get_name(device_name, sizeof(device_name));
@@ -148,13 +250,14 @@ bool comm_get_advertising(void) { return advertising; }
 bool comm_get_connected(void) { return connected; }
 
 /**
- * @brief Disconnects the current BLE connection
+ * @brief Disconnects all BLE connections
  *
  * @return fn_t kSuccess if successful, kFailure otherwise
  */
 fn_t comm_disconnect(void) {
   LOG_DBG("COMM: Disconnecting...");
   ble_print("Disconnecting...");
+  ble_print_flush();
   fn_t ret = (ble_disconnect() == 0) ? kSuccess : kFailure;
   return ret;
 }
@@ -38,7 +38,7 @@ bool comm_get_advertising(void);
 bool comm_get_connected(void);
 
 /**
- * @brief Disconnects the current BLE connection
+ * @brief Disconnects all BLE connections
  *
  * @return fn_t kSuccess if successful, kFailure otherwise
  */
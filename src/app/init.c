@@ -25,6 +25,8 @@
 #include "blink.h"
 #include "comm.h"
 #include "ncs_version.h"
+#include "slot_image.h"
+#include "staging.h"
 #include "storage.h"
 #include "version.h"
 
@@ -78,6 +80,12 @@ static int init_main(void) {
   // Initialize
   LOG_INF("zms_storage init");
   ret = (kSuccess != storage_init()) ? kFailure : ret;
+  LOG_INF("blink_staging init");
+  ret = (kSuccess != staging_init()) ? kFailure : ret;
+  if (IS_ENABLED(CONFIG_OPENBLINK_SLOT_XIP)) {
+    LOG_INF("blink_slots init");
+    ret = (kSuccess != slot_image_init()) ? kFailure : ret;
+  }
   LOG_INF("settings_storage init");
   ret = (0 != settings_subsys_init()) ? kFailure : ret;
   storage_free_space();
@@ -127,12 +135,13 @@ fn_t init_reboot(void) {
 /**
  * @brief Performs a factory reset of the device
  *
- * @details Deletes all bytecode from both storage slots
+ * @details Deletes the bytecode of every slot
  *
  * @return fn_t kSuccess if successful
  */
 fn_t init_factory_reset(void) {
-  blink_delete(kBlinkSlot1);
-  blink_delete(kBlinkSlot2);
+  for (size_t i = 0; i < BLINK_SLOT_COUNT; i++) {
+    blink_delete((blink_slot_t)(kBlinkSlot1 + i));
+  }
   return kSuccess;
 }
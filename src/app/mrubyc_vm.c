@@ -13,9 +13,12 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zephyr/irq.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/crc.h>
 
 #include "../../mrubyc/src/mrubyc.h"
 #include "../api/api.h"
@@ -31,21 +34,83 @@
 #include "../rb/slot2.h"
 #include "blink.h"
 #include "init.h"
+#include "profiler.h"
 
 LOG_MODULE_REGISTER(app_mrubyc_vm, LOG_LEVEL_DBG);
 
 /**
  * @brief Size of heap memory for the mruby/c VM in bytes
  */
-#define MRBC_HEAP_MEMORY_SIZE (15 * 1024)
+#define MRBC_HEAP_MEMORY_SIZE (CONFIG_OPENBLINK_VM_HEAP_SIZE)
 
 /**
  * @brief Stack size for the mruby/c VM main thread in bytes
  */
-#define MRUBYC_VM_MAIN_STACK_SIZE (50 * 1024)
+#define MRUBYC_VM_MAIN_STACK_SIZE (CONFIG_OPENBLINK_VM_STACK_SIZE)
+
+/**
+ * @brief Time a slot reload waits for the scheduler to idle in milliseconds
+ * @details The VM is restarted instead if no task sleeps within this time
+ */
+#define MRUBYC_VM_RELOAD_TIMEOUT_MS (1000)
+
+BUILD_ASSERT(MRUBYC_VM_SLOT_COUNT <= MAX_VM_COUNT,
+             "CONFIG_OPENBLINK_SLOT_COUNT exceeds MAX_VM_COUNT");
 
 static mrbc_tcb* tcb[MAX_VM_COUNT] = {NULL};
 
+/**
+ * @brief Factory default program of each slot, indexed from kBlinkSlot1
+ * @details Slots past the end of the table have none
+ */
+static const struct {
+  const uint8_t* bytecode; /**< Bytecode in the application image */
+  size_t length;           /**< Length of the bytecode */
+} vm_defaults[] = {
+    {.bytecode = slot1, .length = sizeof(slot1)},
+    {.bytecode = slot2, .length = sizeof(slot2)},
+};
+
+/** @brief Run state of the VM */
+static volatile mrubyc_vm_state_t vm_state = kMrubycVmStateLoading;
+
+/** @brief Number of times the VM has been restarted */
+static volatile uint16_t vm_restarts = 0;
+
+/** @brief Length and CRC16 of the bytecode loaded into each slot */
+static mrubyc_vm_slot_t vm_slots[MRUBYC_VM_SLOT_COUNT];
+
+/** @brief Bytecode run by the task of each slot, NULL if none */
+static const uint8_t* volatile vm_bytecode[MRUBYC_VM_SLOT_COUNT];
+
+/**
+ * @brief Heap and bytecode buffers of the VM
+ * @details Placed in .noinit, so neither boot nor a restart clears it.
+ * mrbc_init() sets up the heap, and each bytecode buffer is overwritten by
+ * the bytecode of its slot, or cleared if the slot could not be loaded. With
+ * CONFIG_OPENBLINK_SLOT_XIP the tasks run the bytecode from the slot
+ * partition, so there are no bytecode buffers.
+ */
+static __noinit struct {
+  uint8_t heap[MRBC_HEAP_MEMORY_SIZE] __aligned(8); /**< mruby/c heap */
+#if !defined(CONFIG_OPENBLINK_SLOT_XIP)
+  /** Bytecode of each slot, referenced by its task while it runs */
+  uint8_t bytecode[MRUBYC_VM_SLOT_COUNT][BLINK_MAX_BYTECODE_SIZE];
+#endif
+} vm_arena;
+
+/** @brief Slots waiting to be reloaded, one bit per slot */
+static atomic_t vm_reload = ATOMIC_INIT(0);
+
+#if defined(CONFIG_OPENBLINK_SLOT_XIP)
+/**
+ * @brief Maps bytecode from the slot partition or default slots
+ *
+ * @param kSlot The slot to map
+ * @return const uint8_t* Bytecode to run in place, NULL if there is none
+ */
+static const uint8_t* map_bytecode(const blink_slot_t kSlot);
+#else
 /**
  * @brief Loads bytecode from storage or default slots
  *
@@ -56,6 +121,26 @@ static mrbc_tcb* tcb[MAX_VM_COUNT] = {NULL};
 static void load_bytecode(const blink_slot_t kSlot, uint8_t* const bytecode,
                           const size_t kLength);
 
+/**
+ * @brief Copies bytecode from storage or default slots
+ *
+ * @param kSlot The slot to load from
+ * @param bytecode Buffer to store the bytecode
+ * @param kLength Maximum length of the buffer
+ * @return ssize_t Length of the bytecode, or 0 or negative if none was loaded
+ */
+static ssize_t load_bytecode_data(const blink_slot_t kSlot,
+                                  uint8_t* const bytecode,
+                                  const size_t kLength);
+#endif
+
+/**
+ * @brief Loads the bytecode of a slot and creates its task
+ *
+ * @param kSlot The slot to start
+ */
+static void start_slot(const blink_slot_t kSlot);
+
 /**
  * @brief Main function for the mruby/c VM thread
  *
@@ -66,11 +151,14 @@ static void load_bytecode(const blink_slot_t kSlot, uint8_t* const bytecode,
 static void mrubyc_vm_main(void*, void*, void*);
 
 /**
- * @brief Timer handler for the mruby/c VM
+ * @brief Restarts the VM if a slot reload is still waiting
  *
- * @param timer Timer instance
+ * @param work Work item that triggered the handler
  */
-static void mrubyc_timerhandler(struct k_timer* const timer) { mrbc_tick(); }
+static void reload_timeout(struct k_work* work);
+
+/** @brief Work item that limits how long a slot reload waits */
+static K_WORK_DELAYABLE_DEFINE(vm_reload_work, reload_timeout);
 
 /**
  * @brief Thread definition for the mruby/c VM main function
@@ -78,11 +166,6 @@ static void mrubyc_timerhandler(struct k_timer* const timer) { mrbc_tick(); }
 K_THREAD_DEFINE(th_mrubyc_vm_main, MRUBYC_VM_MAIN_STACK_SIZE, mrubyc_vm_main,
                 NULL, NULL, NULL, 1, 0, 1);
 
-/**
- * @brief Timer definition for the mruby/c VM
- */
-K_TIMER_DEFINE(timer_mrubyc, mrubyc_timerhandler, NULL);
-
 /**
  * @brief Mutex definition for the mruby/c VM restart
  */
@@ -104,12 +187,60 @@ fn_t app_mrubyc_vm_restart(void) {
       if (NULL != tcb[i]) {
         mrbc_terminate_task(tcb[i]);
         mrbc_delete_task(tcb[i]);
+        tcb[i] = NULL;
       }
     }
     // =====
     irq_unlock(kIrqLockKey);
     k_sched_unlock();
+    // Let an idle scheduler notice that the tasks are gone
+    hal_wake_cpu();
+    k_mutex_unlock(&mutex_mrubyc_vm_restart);
+    return kSuccess;
+  } else {
+    LOG_ERR("Failed to lock mutex_mrubyc_vm_restart");
+    return kFailure;
+  }
+}
+
+/**
+ * @brief Reloads the bytecode of one slot
+ *
+ * @details For an isolated slot, terminates the task of the slot at once.
+ * The VM thread deletes it and starts the new bytecode the next time the
+ * scheduler idles, while the tasks of the other slots keep running. Methods
+ * and classes defined by a program keep pointing into its ireps and
+ * bytecode, which deleting the task frees and reloading overwrites, so any
+ * other slot restarts the whole VM instead, as does a VM that is not running.
+ *
+ * @param kSlot The slot to reload
+ * @return fn_t kSuccess if the reload was requested
+ */
+fn_t app_mrubyc_vm_reload_slot(const blink_slot_t kSlot) {
+  if (!blink_slot_is_valid(kSlot)) {
+    LOG_ERR("Invalid reload slot %d", kSlot);
+    return kFailure;
+  }
+  if ((kMrubycVmStateRunning != vm_state) ||
+      !blink_get_slot_config(kSlot)->isolated) {
+    return app_mrubyc_vm_restart();
+  }
+
+  const size_t kIndex = kSlot - kBlinkSlot1;
+  if (0 == k_mutex_lock(&mutex_mrubyc_vm_restart, K_MSEC(1000))) {
+    k_sched_lock();
+    const unsigned int kIrqLockKey = irq_lock();
+    // =====
+    if ((NULL != tcb[kIndex]) && !atomic_test_bit(&vm_reload, kIndex)) {
+      mrbc_terminate_task(tcb[kIndex]);
+    }
+    atomic_set_bit(&vm_reload, kIndex);
+    // =====
+    irq_unlock(kIrqLockKey);
+    k_sched_unlock();
     k_mutex_unlock(&mutex_mrubyc_vm_restart);
+    k_work_reschedule(&vm_reload_work, K_MSEC(MRUBYC_VM_RELOAD_TIMEOUT_MS));
+    hal_wake_cpu();
     return kSuccess;
   } else {
     LOG_ERR("Failed to lock mutex_mrubyc_vm_restart");
@@ -117,6 +248,171 @@ fn_t app_mrubyc_vm_restart(void) {
   }
 }
 
+/**
+ * @brief Starts the slots waiting to be reloaded
+ *
+ * @details Runs in the VM thread while the scheduler idles, so no task is
+ * running. Deleting the old task frees its VM, its ireps and the objects only
+ * it held, and the bytecode buffer of the slot is overwritten. Only isolated
+ * slots get here, whose programs left nothing global pointing into either.
+ */
+static void reload_slots(void) {
+  if ((0 == atomic_get(&vm_reload)) ||
+      (0 != k_mutex_lock(&mutex_mrubyc_vm_restart, K_NO_WAIT))) {
+    return;
+  }
+  const atomic_val_t kPending = atomic_clear(&vm_reload);
+  k_work_cancel_delayable(&vm_reload_work);
+
+  char buf_blink_time[100] = {0};
+  for (size_t i = 0; i < MRUBYC_VM_SLOT_COUNT; i++) {
+    if (0 == (kPending & BIT(i))) {
+      continue;
+    }
+    int64_t timestamp = k_uptime_get();
+    if (NULL != tcb[i]) {
+      const unsigned int kIrqLockKey = irq_lock();
+      mrbc_delete_task(tcb[i]);
+      tcb[i] = NULL;
+      irq_unlock(kIrqLockKey);
+    }
+    start_slot((blink_slot_t)(kBlinkSlot1 + i));
+    snprintf(buf_blink_time, sizeof(buf_blink_time),
+             "Blinked slot:%d (%lli ms)\n", (int)(kBlinkSlot1 + i),
+             k_uptime_delta(&timestamp));
+    ble_print(buf_blink_time);
+  }
+  k_mutex_unlock(&mutex_mrubyc_vm_restart);
+}
+
+/**
+ * @brief Restarts the VM if a slot reload is still waiting
+ *
+ * @details Tasks that never sleep keep the scheduler from idling
+ *
+ * @param work Work item that triggered the handler
+ */
+static void reload_timeout(struct k_work* work) {
+  if (0 != atomic_get(&vm_reload)) {
+    LOG_WRN("Slot reload timed out, restarting the VM");
+    app_mrubyc_vm_restart();
+  }
+}
+
+/**
+ * @brief Gets the factory default program of a slot
+ *
+ * @param kSlot The slot to look up
+ * @param length Set to the length of the bytecode, 0 if there is none
+ * @return const uint8_t* Bytecode, NULL if the slot has no default program
+ */
+static const uint8_t* default_bytecode(const blink_slot_t kSlot,
+                                       size_t* const length) {
+  const size_t kIndex = kSlot - kBlinkSlot1;
+  if (ARRAY_SIZE(vm_defaults) <= kIndex) {
+    *length = 0;
+    return NULL;
+  }
+  *length = vm_defaults[kIndex].length;
+  return vm_defaults[kIndex].bytecode;
+}
+
+/**
+ * @brief Gets the part of the VM heap a slot is expected to stay within
+ *
+ * @param kSlot The slot to check
+ * @return size_t Heap share of the slot in bytes
+ */
+static size_t slot_heap_budget(const blink_slot_t kSlot) {
+  size_t total = 0;
+  for (size_t i = 0; i < MRUBYC_VM_SLOT_COUNT; i++) {
+    total += blink_get_slot_config((blink_slot_t)(kBlinkSlot1 + i))->heap_share;
+  }
+  if (0 == total) {
+    return MRBC_HEAP_MEMORY_SIZE;
+  }
+  return (MRBC_HEAP_MEMORY_SIZE * blink_get_slot_config(kSlot)->heap_share) /
+         total;
+}
+
+/**
+ * @brief Loads the bytecode of a slot and creates its task
+ *
+ * @details The task runs with the priority of the slot table. mruby/c shares
+ * one heap between all tasks, so the heap share is checked against what
+ * loading the bytecode used, and exceeding it is only reported.
+ *
+ * @param kSlot The slot to start
+ */
+static void start_slot(const blink_slot_t kSlot) {
+  const size_t kIndex = kSlot - kBlinkSlot1;
+  tcb[kIndex] = NULL;
+#if defined(CONFIG_OPENBLINK_SLOT_XIP)
+  const uint8_t* const kBytecode = map_bytecode(kSlot);
+#else
+  const uint8_t* const kBytecode = vm_arena.bytecode[kIndex];
+  load_bytecode(kSlot, vm_arena.bytecode[kIndex],
+                sizeof(vm_arena.bytecode[kIndex]));
+#endif
+  vm_bytecode[kIndex] = kBytecode;
+  if (0 == vm_slots[kIndex].length) {
+    LOG_DBG("Slot:%d is empty", kSlot);
+    return;
+  }
+
+  struct MRBC_ALLOC_STATISTICS before;
+  struct MRBC_ALLOC_STATISTICS after;
+  mrbc_alloc_statistics(&before);
+  tcb[kIndex] = mrbc_create_task(kBytecode, NULL);
+  if (NULL == tcb[kIndex]) {
+    LOG_ERR("Failed to create task");
+    return;
+  }
+  mrbc_change_priority(tcb[kIndex],
+                       (int)blink_get_slot_config(kSlot)->priority);
+
+  mrbc_alloc_statistics(&after);
+  const size_t kUsed = after.used - before.used;
+  const size_t kBudget = slot_heap_budget(kSlot);
+  if (kUsed > kBudget) {
+    char buf[64] = {0};
+    snprintf(buf, sizeof(buf), "WARNING: slot:%d heap %d/%d bytes\n",
+             (int)kSlot, (int)kUsed, (int)kBudget);
+    ble_print(buf);
+    LOG_WRN("Slot:%d uses %d of its %d heap bytes at load", kSlot, kUsed,
+            kBudget);
+  }
+}
+
+/**
+ * @brief Samples the instruction the running task executes
+ *
+ * @details Runs in the tick ISR, so the running task is the one the VM
+ * thread was interrupted in. mruby/c runs the bytecode where it was loaded,
+ * so the instruction pointer lies within the bytecode of the slot. While a
+ * native method runs, it points past the instruction that called it.
+ */
+static void sample_tick(void) {
+  if (!profiler_due()) {
+    return;
+  }
+  for (size_t i = 0; i < MRUBYC_VM_SLOT_COUNT; i++) {
+    const mrbc_tcb* const kTask = tcb[i];
+    if ((NULL == kTask) || (TASKSTATE_RUNNING != kTask->state)) {
+      continue;
+    }
+    const uint8_t* const kBase = vm_bytecode[i];
+    const uint8_t* const kInst = kTask->vm.inst;
+    if ((NULL != kBase) && (kBase <= kInst) &&
+        (kInst <= &kBase[vm_slots[i].length])) {
+      profiler_sample((uint8_t)(kBlinkSlot1 + i), (uint16_t)(kInst - kBase));
+      return;
+    }
+    break;
+  }
+  profiler_sample_other();
+}
+
 /**
  * @brief Main function for the mruby/c VM thread
  *
@@ -131,16 +427,21 @@ static void mrubyc_vm_main(void*, void*, void*) {
   int64_t timestamp = k_uptime_get();
   char buf_blink_time[100] = {0};
 
+  // Sleeping tasks decide how long the scheduler may idle
+  hal_set_tasks(tcb, MAX_VM_COUNT);
+  hal_set_idle_callback(reload_slots);
+  hal_set_tick_callback(sample_tick);
+
   while (1) {
+    vm_state = kMrubycVmStateLoading;
     for (size_t i = 0; i < MAX_VM_COUNT; i++) {
       tcb[i] = NULL;
     }
-    uint8_t memory_pool[MRBC_HEAP_MEMORY_SIZE] = {0};
-    uint8_t bytecode_slot1[BLINK_MAX_BYTECODE_SIZE] = {0};
-    uint8_t bytecode_slot2[BLINK_MAX_BYTECODE_SIZE] = {0};
+    // Every autostart slot is loaded below
+    atomic_clear(&vm_reload);
 
     // mruby/c initialize
-    mrbc_init(memory_pool, MRBC_HEAP_MEMORY_SIZE);
+    mrbc_init(vm_arena.heap, sizeof(vm_arena.heap));
 
     ////////////////////
     // Symbol
@@ -155,31 +456,29 @@ static void mrubyc_vm_main(void*, void*, void*) {
     api_pixels_define();  // PIXELS.*
 
     ////////////////////
-    // Load mruby bytecode
-    load_bytecode(kBlinkSlot1, bytecode_slot1,
-                  sizeof(bytecode_slot1) / sizeof(bytecode_slot1[0]));
-    load_bytecode(kBlinkSlot2, bytecode_slot2,
-                  sizeof(bytecode_slot2) / sizeof(bytecode_slot2[0]));
-
-    ////////////////////
-    // mruby/c create task
-    tcb[0] = mrbc_create_task(bytecode_slot1, NULL);
-    tcb[1] = mrbc_create_task(bytecode_slot2, NULL);
-    if ((tcb[0] == NULL) || (tcb[1] == NULL)) {
-      LOG_ERR("Failed to create task");
+    // Load mruby bytecode and create tasks
+    for (size_t i = 0; i < MRUBYC_VM_SLOT_COUNT; i++) {
+      const blink_slot_t kSlot = (blink_slot_t)(kBlinkSlot1 + i);
+      if (blink_get_slot_config(kSlot)->autostart) {
+        start_slot(kSlot);
+      } else {
+        vm_slots[i] = (mrubyc_vm_slot_t){0};
+        vm_bytecode[i] = NULL;
+      }
     }
-    // set priority
-    mrbc_change_priority(tcb[0], 1);
-    mrbc_change_priority(tcb[1], 2);
 
     ////////////////////
     snprintf(buf_blink_time, sizeof(buf_blink_time), "Blinked (%lli ms)\n",
              k_uptime_delta(&timestamp));
     ble_print(buf_blink_time);
 
-    k_timer_start(&timer_mrubyc, K_NO_WAIT, K_MSEC(1));
+    hal_sample_heap();
+    vm_state = kMrubycVmStateRunning;
+    hal_tick_start();
     mrbc_run();
-    k_timer_stop(&timer_mrubyc);
+    hal_tick_stop();
+    vm_state = kMrubycVmStateStopped;
+    hal_sample_heap();
 
     snprintf(buf_blink_time, sizeof(buf_blink_time),
              "mrbc_run Stopped (uptime: %lli ms)\n",
@@ -189,14 +488,69 @@ static void mrubyc_vm_main(void*, void*, void*) {
     ////////////////////
     // mruby/c cleanup
     mrbc_cleanup();
+    vm_restarts++;
   }
 }
 
+/**
+ * @brief Gets the status of the mruby/c virtual machine
+ *
+ * @param status Pointer to store the status
+ */
+void app_mrubyc_vm_get_status(mrubyc_vm_status_t* const status) {
+  status->state = vm_state;
+  status->restarts = vm_restarts;
+  hal_get_heap(&status->heap_used, &status->heap_free, &status->heap_peak);
+
+  size_t unused = 0;
+  status->stack_size = MRUBYC_VM_MAIN_STACK_SIZE;
+  status->stack_peak = 0;
+  if (0 == k_thread_stack_space_get(th_mrubyc_vm_main, &unused)) {
+    status->stack_peak = MRUBYC_VM_MAIN_STACK_SIZE - unused;
+  }
+
+  for (size_t i = 0; i < MRUBYC_VM_SLOT_COUNT; i++) {
+    status->slots[i] = vm_slots[i];
+  }
+}
+
+#if defined(CONFIG_OPENBLINK_SLOT_XIP)
+/**
+ * @brief Maps bytecode from the slot partition or default slots
+ *
+ * @details Runs the stored bytecode from the memory-mapped slot partition, or
+ * the factory default program from the application image, so nothing is
+ * copied. Also records the length and CRC16 of the mapped bytecode.
+ *
+ * @param kSlot The slot to map
+ * @return const uint8_t* Bytecode to run in place, NULL if there is none
+ */
+static const uint8_t* map_bytecode(const blink_slot_t kSlot) {
+  size_t length = 0;
+  const uint8_t* bytecode = blink_map(kSlot, &length);
+  if (NULL != bytecode) {
+    LOG_DBG("Slot:%d, Size:%d, mapped.", kSlot, length);
+  } else {
+    // Run the factory default program from the application image
+    bytecode = default_bytecode(kSlot, &length);
+    if (NULL != bytecode) {
+      LOG_DBG("Slot:%d, Size:%d, Factory default program mapped.", kSlot,
+              length);
+    }
+  }
+
+  mrubyc_vm_slot_t* const slot = &vm_slots[kSlot - kBlinkSlot1];
+  slot->length = (uint16_t)length;
+  slot->crc = (NULL == bytecode)
+                  ? 0
+                  : crc16_reflect(0xd175U, 0xFFFFU, bytecode, length);
+  return bytecode;
+}
+#else
 /**
  * @brief Loads bytecode from storage or default slots
  *
- * @details Attempts to load bytecode from non-volatile memory first.
- *          If that fails, loads from factory default program.
+ * @details Also records the length and CRC16 of the loaded bytecode
  *
  * @param kSlot The slot to load from
  * @param bytecode Buffer to store the bytecode
@@ -204,6 +558,34 @@ static void mrubyc_vm_main(void*, void*, void*) {
  */
 static void load_bytecode(const blink_slot_t kSlot, uint8_t* const bytecode,
                           const size_t kLength) {
+  ssize_t rc = load_bytecode_data(kSlot, bytecode, kLength);
+
+  mrubyc_vm_slot_t* const slot = &vm_slots[kSlot - kBlinkSlot1];
+  slot->length = 0;
+  slot->crc = 0;
+  if ((0 < rc) && ((size_t)rc <= kLength)) {
+    slot->length = (uint16_t)rc;
+    slot->crc = crc16_reflect(0xd175U, 0xFFFFU, bytecode, (size_t)rc);
+  } else {
+    // Keep a stale program in the reused buffer from being started
+    memset(bytecode, 0, kLength);
+  }
+}
+
+/**
+ * @brief Copies bytecode from storage or default slots
+ *
+ * @details Attempts to load bytecode from non-volatile memory first.
+ *          If that fails, loads from factory default program.
+ *
+ * @param kSlot The slot to load from
+ * @param bytecode Buffer to store the bytecode
+ * @param kLength Maximum length of the buffer
+ * @return ssize_t Length of the bytecode, or 0 or negative if none was loaded
+ */
+static ssize_t load_bytecode_data(const blink_slot_t kSlot,
+                                  uint8_t* const bytecode,
+                                  const size_t kLength) {
   ssize_t rc = 0;
   rc = blink_get_data_length(kSlot);
   if ((0 < rc) && (kLength >= rc)) {
@@ -211,29 +593,20 @@ static void load_bytecode(const blink_slot_t kSlot, uint8_t* const bytecode,
     rc = blink_load(kSlot, bytecode, kLength);
     if (0 < rc) {
       LOG_DBG("Slot:%d, Size:%d/%d", kSlot, rc, kLength);
-      return;
     }
   } else {
     // Load from factory default program
-    switch (kSlot) {
-      case kBlinkSlot1:
-        rc = (ssize_t)sizeof(slot1);
-        if (rc <= (ssize_t)kLength) {
-          memcpy(bytecode, &slot1[0], (size_t)rc);
-        }
-        break;
-      case kBlinkSlot2:
-        rc = (ssize_t)sizeof(slot2);
-        if (rc <= (ssize_t)kLength) {
-          memcpy(bytecode, &slot2[0], (size_t)rc);
-        }
-        break;
-      default:
-        break;
+    size_t length = 0;
+    const uint8_t* const kDefault = default_bytecode(kSlot, &length);
+    rc = (ssize_t)length;
+    if ((NULL != kDefault) && (length <= kLength)) {
+      memcpy(bytecode, kDefault, length);
     }
     if (0 < rc) {
       LOG_DBG("Slot:%d, Size:%d/%d, Factory default program loaded.", kSlot, rc,
               kLength);
     }
   }
+  return rc;
 }
+#endif
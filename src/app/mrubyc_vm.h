@@ -11,8 +11,50 @@
 #define APP_MRUBYC_VM_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "../lib/fn.h"
+#include "blink.h"
+
+/**
+ * @brief Number of bytecode slots run by the VM
+ */
+#define MRUBYC_VM_SLOT_COUNT (BLINK_SLOT_COUNT)
+
+/**
+ * @typedef mrubyc_vm_state_t
+ * @brief Run state of the mruby/c virtual machine
+ */
+typedef enum {
+  kMrubycVmStateLoading = 0U, /**< Loading bytecode and creating tasks */
+  kMrubycVmStateRunning = 1U, /**< Running tasks */
+  kMrubycVmStateStopped = 2U, /**< All tasks finished, about to restart */
+} mrubyc_vm_state_t;
+
+/**
+ * @typedef mrubyc_vm_slot_t
+ * @brief Bytecode loaded into a slot
+ */
+typedef struct {
+  uint16_t length; /**< Length of the bytecode, 0 if none */
+  uint16_t crc;    /**< CRC16 of the bytecode */
+} mrubyc_vm_slot_t;
+
+/**
+ * @typedef mrubyc_vm_status_t
+ * @brief Status of the mruby/c virtual machine
+ */
+typedef struct {
+  mrubyc_vm_state_t state; /**< Run state */
+  uint16_t restarts;       /**< Number of restarts since boot */
+  uint32_t heap_used;      /**< Used heap bytes at the last sample */
+  uint32_t heap_free;      /**< Free heap bytes at the last sample */
+  uint32_t heap_peak;      /**< Highest used heap bytes since boot */
+  uint32_t stack_peak;     /**< Highest used stack bytes of the VM thread */
+  uint32_t stack_size;     /**< Stack size of the VM thread */
+  /** Bytecode loaded into each slot */
+  mrubyc_vm_slot_t slots[MRUBYC_VM_SLOT_COUNT];
+} mrubyc_vm_status_t;
 
 /**
  * @brief Restart the mruby/c virtual machine
@@ -23,4 +65,22 @@
  */
 fn_t app_mrubyc_vm_restart(void);
 
+/**
+ * @brief Reloads the bytecode of one slot
+ *
+ * @details The task of the slot is replaced while the other slots keep
+ * running
+ *
+ * @param kSlot The slot to reload
+ * @return fn_t kSuccess if the reload was requested
+ */
+fn_t app_mrubyc_vm_reload_slot(const blink_slot_t kSlot);
+
+/**
+ * @brief Gets the status of the mruby/c virtual machine
+ *
+ * @param status Pointer to store the status
+ */
+void app_mrubyc_vm_get_status(mrubyc_vm_status_t *const status);
+
 #endif
@@ -0,0 +1,199 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file profiler.c
+ * @brief Implementation of the sampling profiler for mruby/c scripts
+ * @details The histogram is an open-addressing hash table filled from the
+ * tick ISR, so sampling needs no allocation and takes bounded time. A
+ * spinlock keeps readers in other threads consistent with the ISR.
+ */
+#include "profiler.h"
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+LOG_MODULE_REGISTER(app_profiler, LOG_LEVEL_DBG);
+
+/** @brief Sampling state */
+static struct {
+  struct k_spinlock lock; /**< Protects the state against the tick ISR */
+  bool running;           /**< true while sampling */
+  uint8_t interval;       /**< Ticks between samples */
+  uint8_t countdown;      /**< Ticks until the next sample */
+  uint16_t used;          /**< Number of entries in use */
+  int64_t started;        /**< Uptime when sampling started */
+  int64_t stopped;        /**< Uptime when sampling stopped */
+  uint32_t samples;       /**< Samples taken while a task was running */
+  uint32_t other;         /**< Samples outside the bytecode of any slot */
+  uint32_t dropped;       /**< Samples lost because the histogram was full */
+  /** Histogram, an entry with slot 0 is unused */
+  profiler_entry_t entries[PROFILER_ENTRY_COUNT];
+} profiler;
+
+/**
+ * @brief Clears the histogram and starts sampling
+ *
+ * @details Each scheduler tick is one millisecond, so the interval is also
+ * the number of ticks between samples
+ *
+ * @param kInterval Sampling interval in milliseconds, 0 for every tick
+ */
+void profiler_start(const uint8_t kInterval) {
+  k_spinlock_key_t key = k_spin_lock(&profiler.lock);
+  memset(profiler.entries, 0, sizeof(profiler.entries));
+  profiler.used = 0;
+  profiler.samples = 0;
+  profiler.other = 0;
+  profiler.dropped = 0;
+  profiler.interval = MAX(kInterval, 1U);
+  profiler.countdown = profiler.interval;
+  profiler.started = k_uptime_get();
+  profiler.running = true;
+  k_spin_unlock(&profiler.lock, key);
+  LOG_DBG("Profiler started, interval %d ms", profiler.interval);
+}
+
+/**
+ * @brief Stops sampling and keeps the histogram
+ */
+void profiler_stop(void) {
+  k_spinlock_key_t key = k_spin_lock(&profiler.lock);
+  if (profiler.running) {
+    profiler.stopped = k_uptime_get();
+    profiler.running = false;
+  }
+  k_spin_unlock(&profiler.lock, key);
+}
+
+/**
+ * @brief Counts a scheduler tick and checks whether to sample it
+ *
+ * @details Called from the tick ISR. Returns false at once while stopped, so
+ * the tick costs next to nothing then.
+ *
+ * @return true if a sample is due
+ */
+bool profiler_due(void) {
+  if (!profiler.running) {
+    return false;
+  }
+  if (1U < profiler.countdown) {
+    profiler.countdown--;
+    return false;
+  }
+  profiler.countdown = profiler.interval;
+  return true;
+}
+
+/**
+ * @brief Adds a sample of a running task
+ *
+ * @details Called from the tick ISR. Probes linearly from the hash of the
+ * slot and offset; a sample for a new offset is dropped once the histogram
+ * is full.
+ *
+ * @param kSlot Slot of the running task
+ * @param kOffset Offset of its instruction pointer in the bytecode
+ */
+void profiler_sample(const uint8_t kSlot, const uint16_t kOffset) {
+  k_spinlock_key_t key = k_spin_lock(&profiler.lock);
+  if (!profiler.running) {
+    k_spin_unlock(&profiler.lock, key);
+    return;
+  }
+  profiler.samples++;
+  const uint32_t kKey = ((uint32_t)kSlot << 16) | kOffset;
+  size_t index = (kKey * 2654435761U) % PROFILER_ENTRY_COUNT;
+  bool found = false;
+  for (size_t i = 0; i < PROFILER_ENTRY_COUNT; i++) {
+    profiler_entry_t *const entry = &profiler.entries[index];
+    if (0 == entry->slot) {
+      entry->slot = kSlot;
+      entry->offset = kOffset;
+      profiler.used++;
+    }
+    if ((kSlot == entry->slot) && (kOffset == entry->offset)) {
+      entry->hits++;
+      found = true;
+      break;
+    }
+    index = (index + 1) % PROFILER_ENTRY_COUNT;
+  }
+  if (!found) {
+    profiler.dropped++;
+  }
+  k_spin_unlock(&profiler.lock, key);
+}
+
+/**
+ * @brief Adds a sample that no slot bytecode was running
+ *
+ * @details Called from the tick ISR, for example while the scheduler
+ * switches tasks
+ */
+void profiler_sample_other(void) {
+  k_spinlock_key_t key = k_spin_lock(&profiler.lock);
+  if (profiler.running) {
+    profiler.other++;
+  }
+  k_spin_unlock(&profiler.lock, key);
+}
+
+/**
+ * @brief Reads a page of the histogram
+ *
+ * @details Entries are indexed in table order, skipping unused ones. New
+ * offsets may land before the page being read while sampling runs, so the
+ * profile should be stopped before it is read.
+ *
+ * @param kFirst Index of the first entry to read
+ * @param page Buffer for the page
+ * @param kSize Size of the buffer, at least sizeof(profiler_page_t)
+ * @return size_t Length of the page in bytes, 0 if the buffer is too small
+ */
+size_t profiler_read(const uint16_t kFirst, void *const page,
+                     const size_t kSize) {
+  if (sizeof(profiler_page_t) > kSize) {
+    return 0;
+  }
+  profiler_page_t header = {
+      .marker = PROFILER_MARKER,
+      .version = PROFILER_VERSION,
+  };
+  uint8_t *const out = page;
+  const size_t kMax = MIN((kSize - sizeof(header)) / sizeof(profiler_entry_t),
+                          PROFILER_PAGE_ENTRIES);
+
+  k_spinlock_key_t key = k_spin_lock(&profiler.lock);
+  header.interval = profiler.interval;
+  header.total = profiler.used;
+  header.first = kFirst;
+  header.elapsed =
+      (uint32_t)((profiler.running ? k_uptime_get() : profiler.stopped) -
+                 profiler.started);
+  header.samples = profiler.samples;
+  header.other = profiler.other;
+  header.dropped = profiler.dropped;
+  size_t index = 0;
+  for (size_t i = 0; (i < PROFILER_ENTRY_COUNT) && (header.count < kMax);
+       i++) {
+    const profiler_entry_t *const kEntry = &profiler.entries[i];
+    if (0 == kEntry->slot) {
+      continue;
+    }
+    if (kFirst <= index) {
+      memcpy(&out[sizeof(header) + (header.count * sizeof(*kEntry))], kEntry,
+             sizeof(*kEntry));
+      header.count++;
+    }
+    index++;
+  }
+  k_spin_unlock(&profiler.lock, key);
+
+  memcpy(out, &header, sizeof(header));
+  return sizeof(header) + (header.count * sizeof(profiler_entry_t));
+}
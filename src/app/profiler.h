@@ -0,0 +1,128 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file profiler.h
+ * @brief Sampling profiler for mruby/c scripts
+ * @details Counts where the running task is when the scheduler tick fires.
+ * Each sample is the slot and the offset of the instruction pointer in the
+ * bytecode of the slot, so a host with the .mrb file and its debug info can
+ * map the histogram back to Ruby source lines.
+ */
+#ifndef APP_PROFILER_H
+#define APP_PROFILER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of distinct instruction offsets the histogram holds
+ */
+#define PROFILER_ENTRY_COUNT (CONFIG_OPENBLINK_PROFILER_ENTRIES)
+
+/**
+ * @brief Maximum number of entries in one report page
+ */
+#define PROFILER_PAGE_ENTRIES (32)
+
+/**
+ * @brief First byte of a report page
+ * @details Kept from the time pages were sent through the console, so the
+ * layout of version 1 is unchanged
+ */
+#define PROFILER_MARKER (0x00U)
+
+/**
+ * @brief Layout version of a report page
+ */
+#define PROFILER_VERSION (1)
+
+#pragma pack(1)
+/**
+ * @typedef profiler_page_t
+ * @brief Header of a report page
+ * @details Followed by count profiler_entry_t entries
+ */
+typedef struct {
+  uint8_t marker;   /**< PROFILER_MARKER */
+  uint8_t version;  /**< PROFILER_VERSION */
+  uint8_t interval; /**< Sampling interval in milliseconds */
+  uint8_t count;    /**< Number of entries in this page */
+  uint16_t first;   /**< Index of the first entry of this page */
+  uint16_t total;   /**< Number of entries in the histogram */
+  uint32_t elapsed; /**< Milliseconds since the profile was started */
+  uint32_t samples; /**< Samples taken while a task was running */
+  uint32_t other;   /**< Samples outside the bytecode of any slot */
+  uint32_t dropped; /**< Samples lost because the histogram was full */
+} profiler_page_t; /**< 24 bytes total */
+
+/**
+ * @typedef profiler_entry_t
+ * @brief Histogram entry of a report page
+ */
+typedef struct {
+  uint8_t slot;     /**< Slot whose bytecode was running */
+  uint8_t reserved; /**< Reserved for future use */
+  uint16_t offset;  /**< Offset of the instruction pointer in the bytecode */
+  uint32_t hits;    /**< Number of samples at this offset */
+} profiler_entry_t; /**< 8 bytes total */
+#pragma pack()
+
+/**
+ * @brief Size of a full report page in bytes
+ */
+#define PROFILER_PAGE_SIZE \
+  (sizeof(profiler_page_t) + (PROFILER_PAGE_ENTRIES * sizeof(profiler_entry_t)))
+
+/**
+ * @brief Clears the histogram and starts sampling
+ *
+ * @param kInterval Sampling interval in milliseconds, 0 for every tick
+ */
+void profiler_start(const uint8_t kInterval);
+
+/**
+ * @brief Stops sampling and keeps the histogram
+ */
+void profiler_stop(void);
+
+/**
+ * @brief Counts a scheduler tick and checks whether to sample it
+ *
+ * @details Called from the tick ISR
+ *
+ * @return true if a sample is due
+ */
+bool profiler_due(void);
+
+/**
+ * @brief Adds a sample of a running task
+ *
+ * @details Called from the tick ISR
+ *
+ * @param kSlot Slot of the running task
+ * @param kOffset Offset of its instruction pointer in the bytecode
+ */
+void profiler_sample(const uint8_t kSlot, const uint16_t kOffset);
+
+/**
+ * @brief Adds a sample that no slot bytecode was running
+ *
+ * @details Called from the tick ISR
+ */
+void profiler_sample_other(void);
+
+/**
+ * @brief Reads a page of the histogram
+ *
+ * @param kFirst Index of the first entry to read
+ * @param page Buffer for the page
+ * @param kSize Size of the buffer, at least sizeof(profiler_page_t)
+ * @return size_t Length of the page in bytes, 0 if the buffer is too small
+ */
+size_t profiler_read(const uint16_t kFirst, void *const page,
+                     const size_t kSize);
+
+#endif  // APP_PROFILER_H
@@ -0,0 +1,480 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file slot_image.c
+ * @brief Implementation of the memory-mapped bytecode slots
+ * @details The blink_slots partition is split into two banks per slot. A bank
+ * holds a slot_image_header_t followed by the bytecode, so the bytecode can be
+ * passed to the VM at its memory-mapped address. A store writes the bank the
+ * VM does not run from and writes the header last, with a sequence number one
+ * higher than the current bank. The valid bank with the highest sequence
+ * number is the stored bytecode of the slot. It is found at init and kept
+ * up to date by stores and deletes, so reads do not check the CRC16 again.
+ */
+#include "slot_image.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/util.h>
+
+LOG_MODULE_REGISTER(app_slot_image, LOG_LEVEL_DBG);
+
+/** @brief Slot partition name */
+#define SLOT_IMAGE_PARTITION blink_slots
+
+/** @brief Memory-mapped address of the slot partition */
+#define SLOT_IMAGE_PARTITION_ADDRESS      \
+  (DT_REG_ADDR(DT_CHOSEN(zephyr_flash)) + \
+   FIXED_PARTITION_OFFSET(SLOT_IMAGE_PARTITION))
+
+/** @brief Number of slots in the partition */
+#define SLOT_IMAGE_SLOT_COUNT (BLINK_SLOT_COUNT)
+
+/**
+ * @brief Alignment of the banks in bytes
+ * @details The erase page of the flash, which is also a multiple of its
+ * write block, so each bank can be erased and written on its own
+ */
+#define SLOT_IMAGE_ALIGN \
+  (DT_PROP_OR(DT_CHOSEN(zephyr_flash), erase_block_size, 4096))
+
+/**
+ * @brief Size of each bank in bytes
+ * @details Rounded down to SLOT_IMAGE_ALIGN, so a slot count that does not
+ * divide the partition evenly still gives aligned banks
+ */
+#define SLOT_IMAGE_BANK_SIZE                                      \
+  ROUND_DOWN(FIXED_PARTITION_SIZE(SLOT_IMAGE_PARTITION) /         \
+                 (SLOT_IMAGE_SLOT_COUNT * SLOT_IMAGE_BANK_COUNT), \
+             SLOT_IMAGE_ALIGN)
+
+BUILD_ASSERT(0 == (FIXED_PARTITION_OFFSET(SLOT_IMAGE_PARTITION) %
+                   SLOT_IMAGE_ALIGN),
+             "blink_slots partition does not start on an erase page");
+BUILD_ASSERT(sizeof(slot_image_header_t) + BLINK_MAX_BYTECODE_SIZE <=
+                 SLOT_IMAGE_BANK_SIZE,
+             "blink_slots partition too small for the slot count and "
+             "bytecode size");
+
+/**
+ * @brief Size of the write buffer in bytes
+ * @details Multiple of the write block size of both flash and RRAM
+ */
+#define SLOT_IMAGE_PAGE_SIZE (256)
+
+/** @brief CRC16 polynomial of the Blink protocol */
+#define SLOT_IMAGE_CRC16_POLY (0xd175U)
+
+/** @brief CRC16 seed of the Blink protocol */
+#define SLOT_IMAGE_CRC16_SEED (0xFFFFU)
+
+/** @brief Mutex for the banks and the mapped state */
+static K_MUTEX_DEFINE(slot_image_mutex);
+
+/** @brief Slot partition state */
+static struct {
+  const struct flash_area *fa; /**< Slot partition */
+  bool explicit_erase;         /**< true if flash must be erased first */
+  /** Bank each slot was last mapped from, -1 if none */
+  int8_t mapped[SLOT_IMAGE_SLOT_COUNT];
+  /** Bank holding the stored bytecode of each slot, -1 if empty */
+  int8_t active[SLOT_IMAGE_SLOT_COUNT];
+  /** Write buffer, the source may itself be memory-mapped flash */
+  uint8_t page[SLOT_IMAGE_PAGE_SIZE] __aligned(4);
+} slot_image;
+
+/**
+ * @brief Checks that a slot is valid and the partition is open
+ *
+ * @param kSlot The slot to check
+ * @return true if the slot can be accessed
+ */
+static bool slot_image_ready(const blink_slot_t kSlot) {
+  return (NULL != slot_image.fa) && blink_slot_is_valid(kSlot);
+}
+
+/**
+ * @brief Gets the offset of a bank in the partition
+ *
+ * @param kSlot The slot of the bank
+ * @param kBank Bank index
+ * @return size_t Offset of the bank
+ */
+static size_t slot_image_offset(const blink_slot_t kSlot, const size_t kBank) {
+  return (((kSlot - kBlinkSlot1) * SLOT_IMAGE_BANK_COUNT) + kBank) *
+         SLOT_IMAGE_BANK_SIZE;
+}
+
+/**
+ * @brief Gets the memory-mapped header of a bank
+ *
+ * @param kSlot The slot of the bank
+ * @param kBank Bank index
+ * @return const slot_image_header_t* Header, followed by the bytecode
+ */
+static const slot_image_header_t *slot_image_bank(const blink_slot_t kSlot,
+                                                  const size_t kBank) {
+  return (const slot_image_header_t *)(SLOT_IMAGE_PARTITION_ADDRESS +
+                                       slot_image_offset(kSlot, kBank));
+}
+
+/**
+ * @brief Checks the header and the CRC16 of a bank
+ *
+ * @param kHeader Memory-mapped header of the bank
+ * @return true if the bank holds complete bytecode
+ */
+static bool slot_image_valid(const slot_image_header_t *const kHeader) {
+  if ((SLOT_IMAGE_MAGIC != kHeader->magic) || (0 == kHeader->length) ||
+      (BLINK_MAX_BYTECODE_SIZE < kHeader->length)) {
+    return false;
+  }
+  return kHeader->crc == crc16_reflect(SLOT_IMAGE_CRC16_POLY,
+                                       SLOT_IMAGE_CRC16_SEED,
+                                       (const uint8_t *)(kHeader + 1),
+                                       kHeader->length);
+}
+
+/**
+ * @brief Finds the bank holding the stored bytecode of a slot
+ *
+ * @details Checks the CRC16 of both banks, so it is only called at init and
+ * after a bank was written or invalidated; slot_image_active() returns the
+ * result.
+ *
+ * @param kSlot The slot to check
+ * @return int Bank index, -1 if the slot is empty
+ */
+static int slot_image_find_active(const blink_slot_t kSlot) {
+  int active = -1;
+  for (size_t i = 0; i < SLOT_IMAGE_BANK_COUNT; i++) {
+    const slot_image_header_t *const kHeader = slot_image_bank(kSlot, i);
+    if (!slot_image_valid(kHeader)) {
+      continue;
+    }
+    if ((0 > active) ||
+        (0 < (int32_t)(kHeader->sequence -
+                       slot_image_bank(kSlot, active)->sequence))) {
+      active = (int)i;
+    }
+  }
+  return active;
+}
+
+/**
+ * @brief Gets the bank holding the stored bytecode of a slot
+ *
+ * @details The caller holds slot_image_mutex
+ *
+ * @param kSlot The slot to check
+ * @return int Bank index, -1 if the slot is empty
+ */
+static int slot_image_active(const blink_slot_t kSlot) {
+  return slot_image.active[kSlot - kBlinkSlot1];
+}
+
+/**
+ * @brief Writes data to the partition through the write buffer
+ *
+ * @details The last block is padded with 0xFF up to the write block size
+ *
+ * @param kOffset Offset in the partition, aligned to the write block size
+ * @param kData Data to write
+ * @param kLength Length of the data
+ * @return int 0 on success, negative on error
+ */
+static int slot_image_program(const size_t kOffset, const void *const kData,
+                              const size_t kLength) {
+  const size_t kAlign = flash_area_align(slot_image.fa);
+  const uint8_t *const kBytes = kData;
+  for (size_t done = 0; done < kLength;) {
+    const size_t kChunk = MIN(kLength - done, sizeof(slot_image.page));
+    const size_t kPadded = ROUND_UP(kChunk, kAlign);
+    memcpy(slot_image.page, &kBytes[done], kChunk);
+    memset(&slot_image.page[kChunk], 0xFF, kPadded - kChunk);
+    int rc = flash_area_write(slot_image.fa, kOffset + done, slot_image.page,
+                              kPadded);
+    if (0 != rc) {
+      return rc;
+    }
+    done += kChunk;
+  }
+  return 0;
+}
+
+/**
+ * @brief Invalidates the header of a bank
+ *
+ * @details Clearing bits needs no erase, so the bytecode of the bank stays
+ * readable while the VM may still run it
+ *
+ * @param kSlot The slot of the bank
+ * @param kBank Bank index
+ * @return int 0 on success, negative on error
+ */
+static int slot_image_invalidate(const blink_slot_t kSlot, const size_t kBank) {
+  const slot_image_header_t kHeader = {0};
+  if (SLOT_IMAGE_MAGIC != slot_image_bank(kSlot, kBank)->magic) {
+    return 0;
+  }
+  return slot_image_program(slot_image_offset(kSlot, kBank), &kHeader,
+                            sizeof(kHeader));
+}
+
+/**
+ * @brief Initializes the slot partition
+ *
+ * @return fn_t kSuccess if successful, kFailure otherwise
+ */
+fn_t slot_image_init(void) {
+  struct flash_pages_info info;
+  int rc =
+      flash_area_open(FIXED_PARTITION_ID(SLOT_IMAGE_PARTITION), &slot_image.fa);
+  if (0 != rc) {
+    LOG_ERR("Unable to open slot partition, rc=%d", rc);
+    return kFailure;
+  }
+
+  rc = flash_get_page_info_by_offs(slot_image.fa->fa_dev,
+                                   slot_image.fa->fa_off, &info);
+  if (0 != rc) {
+    LOG_ERR("Unable to get page info, rc=%d", rc);
+    slot_image.fa = NULL;
+    return kFailure;
+  }
+  slot_image.explicit_erase =
+      (0 != (flash_params_get_erase_cap(flash_get_parameters(
+                 slot_image.fa->fa_dev)) &
+             FLASH_ERASE_C_EXPLICIT));
+
+  // Each bank is erased on its own
+  if (slot_image.explicit_erase && (0 != (SLOT_IMAGE_BANK_SIZE % info.size))) {
+    LOG_ERR("Slot bank size %d is not a multiple of the erase page size %d",
+            SLOT_IMAGE_BANK_SIZE, info.size);
+    slot_image.fa = NULL;
+    return kFailure;
+  }
+
+  for (size_t i = 0; i < SLOT_IMAGE_SLOT_COUNT; i++) {
+    const blink_slot_t kSlot = (blink_slot_t)(kBlinkSlot1 + i);
+    const int kActive = slot_image_find_active(kSlot);
+    slot_image.mapped[i] = -1;
+    slot_image.active[i] = (int8_t)kActive;
+    if (0 <= kActive) {
+      LOG_DBG("slot %d: bank %d, %d bytes", kSlot, kActive,
+              slot_image_bank(kSlot, kActive)->length);
+    }
+  }
+  return kSuccess;
+}
+
+/**
+ * @brief Maps the bytecode of a slot for execution in place
+ *
+ * @details The returned bank is not overwritten by later stores until the
+ * slot is mapped again, so the VM may run it until then.
+ *
+ * @param kSlot The slot to map
+ * @param length Set to the length of the bytecode
+ * @return const uint8_t* Memory-mapped bytecode, NULL if the slot is empty
+ */
+const uint8_t *slot_image_map(const blink_slot_t kSlot, size_t *const length) {
+  *length = 0;
+  if (!slot_image_ready(kSlot)) {
+    return NULL;
+  }
+  k_mutex_lock(&slot_image_mutex, K_FOREVER);
+  const int kActive = slot_image_active(kSlot);
+  slot_image.mapped[kSlot - kBlinkSlot1] = (int8_t)kActive;
+  k_mutex_unlock(&slot_image_mutex);
+  if (0 > kActive) {
+    return NULL;
+  }
+  const slot_image_header_t *const kHeader = slot_image_bank(kSlot, kActive);
+  *length = kHeader->length;
+  return (const uint8_t *)(kHeader + 1);
+}
+
+/**
+ * @brief Copies the bytecode of a slot
+ *
+ * @details Like a ZMS read, the stored length is returned even if the buffer
+ * is too small to hold all of it. Nothing is copied from an offset at or
+ * past the end.
+ *
+ * @param kSlot The slot to read
+ * @param kOffset Offset in the bytecode to start copying from
+ * @param data Buffer to store the bytecode
+ * @param kLength Maximum length of the buffer
+ * @return ssize_t The length of the bytecode, -ENOENT if the slot is empty,
+ * or negative on error
+ */
+ssize_t slot_image_read(const blink_slot_t kSlot, const size_t kOffset,
+                        void *const data, const size_t kLength) {
+  if (!slot_image_ready(kSlot)) {
+    return -EINVAL;
+  }
+  k_mutex_lock(&slot_image_mutex, K_FOREVER);
+  ssize_t rc = -ENOENT;
+  const int kActive = slot_image_active(kSlot);
+  if (0 <= kActive) {
+    const slot_image_header_t *const kHeader = slot_image_bank(kSlot, kActive);
+    if (kOffset < kHeader->length) {
+      memcpy(data, (const uint8_t *)(kHeader + 1) + kOffset,
+             MIN(kLength, kHeader->length - kOffset));
+    }
+    rc = kHeader->length;
+  }
+  k_mutex_unlock(&slot_image_mutex);
+  return rc;
+}
+
+/**
+ * @brief Stores bytecode to a slot
+ *
+ * @details The bank the VM was last mapped from is never written, and the
+ * current bank is kept unless the VM still runs the other one. If the store
+ * fails, only the bank being written is invalidated, so the slot keeps the
+ * bytecode of its other bank.
+ *
+ * @param kSlot The slot to store to
+ * @param kData Pointer to the bytecode data
+ * @param kLength Length of the bytecode data
+ * @return ssize_t The number of bytes written, 0 if the slot already holds
+ * the same bytecode, or negative on error
+ */
+ssize_t slot_image_write(const blink_slot_t kSlot, const void *const kData,
+                         const size_t kLength) {
+  if (!slot_image_ready(kSlot)) {
+    return -EINVAL;
+  }
+  if ((0 == kLength) || (BLINK_MAX_BYTECODE_SIZE < kLength)) {
+    return -EINVAL;
+  }
+  const uint16_t kCrc = crc16_reflect(SLOT_IMAGE_CRC16_POLY,
+                                      SLOT_IMAGE_CRC16_SEED, kData, kLength);
+
+  k_mutex_lock(&slot_image_mutex, K_FOREVER);
+  const int kActive = slot_image_active(kSlot);
+  uint32_t sequence = 0;
+  if (0 <= kActive) {
+    const slot_image_header_t *const kCurrent = slot_image_bank(kSlot, kActive);
+    if ((kLength == kCurrent->length) && (kCrc == kCurrent->crc) &&
+        (0 == memcmp(kCurrent + 1, kData, kLength))) {
+      k_mutex_unlock(&slot_image_mutex);
+      return 0;
+    }
+    sequence = kCurrent->sequence;
+  }
+
+  // Keep the mapped bank, or else the current one, until the store completes
+  const int kMapped = slot_image.mapped[kSlot - kBlinkSlot1];
+  const size_t kBank = (0 <= kMapped)   ? (size_t)(1 - kMapped)
+                       : (0 <= kActive) ? (size_t)(1 - kActive)
+                                        : 0;
+  const size_t kOffset = slot_image_offset(kSlot, kBank);
+  const slot_image_header_t kHeader = {
+      .magic = SLOT_IMAGE_MAGIC,
+      .sequence = sequence + 1,
+      .length = (uint16_t)kLength,
+      .crc = kCrc,
+      .reserved = 0xFFFFFFFFU,
+  };
+  int rc = slot_image.explicit_erase
+               ? flash_area_erase(slot_image.fa, kOffset, SLOT_IMAGE_BANK_SIZE)
+               : slot_image_invalidate(kSlot, kBank);
+  if (0 == rc) {
+    rc = slot_image_program(kOffset + sizeof(kHeader), kData, kLength);
+  }
+  if (0 == rc) {
+    rc = slot_image_program(kOffset, &kHeader, sizeof(kHeader));
+  }
+  if (0 != rc) {
+    slot_image_invalidate(kSlot, kBank);
+  }
+  slot_image.active[kSlot - kBlinkSlot1] =
+      (int8_t)((0 == rc) ? (int)kBank : slot_image_find_active(kSlot));
+  k_mutex_unlock(&slot_image_mutex);
+
+  if (0 != rc) {
+    LOG_ERR("slot %d: store to bank %d failed, rc=%d", kSlot, kBank, rc);
+    return rc;
+  }
+  LOG_DBG("slot %d: stored %d bytes to bank %d", kSlot, kLength, kBank);
+  return (ssize_t)kLength;
+}
+
+/**
+ * @brief Gets the length of the bytecode of a slot
+ *
+ * @param kSlot The slot to check
+ * @return ssize_t The length of the bytecode, -ENOENT if the slot is empty,
+ * or negative on error
+ */
+ssize_t slot_image_get_length(const blink_slot_t kSlot) {
+  if (!slot_image_ready(kSlot)) {
+    return -EINVAL;
+  }
+  k_mutex_lock(&slot_image_mutex, K_FOREVER);
+  const int kActive = slot_image_active(kSlot);
+  const ssize_t kRc =
+      (0 <= kActive) ? slot_image_bank(kSlot, kActive)->length : -ENOENT;
+  k_mutex_unlock(&slot_image_mutex);
+  return kRc;
+}
+
+/**
+ * @brief Gets the CRC16 of the bytecode of a slot
+ *
+ * @details Taken from the header of the bank, so the bytecode is not read
+ *
+ * @param kSlot The slot to check
+ * @param crc Set to the CRC16 of the bytecode
+ * @return int 0 on success, -ENOENT if the slot is empty, or negative on
+ * error
+ */
+int slot_image_get_crc(const blink_slot_t kSlot, uint16_t *const crc) {
+  if (!slot_image_ready(kSlot)) {
+    return -EINVAL;
+  }
+  k_mutex_lock(&slot_image_mutex, K_FOREVER);
+  const int kActive = slot_image_active(kSlot);
+  if (0 <= kActive) {
+    *crc = slot_image_bank(kSlot, kActive)->crc;
+  }
+  k_mutex_unlock(&slot_image_mutex);
+  return (0 <= kActive) ? 0 : -ENOENT;
+}
+
+/**
+ * @brief Deletes the bytecode of a slot
+ *
+ * @details Only the headers are invalidated, so a mapped bank stays readable
+ *
+ * @param kSlot The slot to delete
+ * @return int 0 on success, negative on error
+ */
+int slot_image_delete(const blink_slot_t kSlot) {
+  if (!slot_image_ready(kSlot)) {
+    return -EINVAL;
+  }
+  int rc = 0;
+  k_mutex_lock(&slot_image_mutex, K_FOREVER);
+  for (size_t i = 0; i < SLOT_IMAGE_BANK_COUNT; i++) {
+    const int kRc = slot_image_invalidate(kSlot, i);
+    rc = (0 == rc) ? kRc : rc;
+  }
+  slot_image.active[kSlot - kBlinkSlot1] =
+      (int8_t)((0 == rc) ? -1 : slot_image_find_active(kSlot));
+  k_mutex_unlock(&slot_image_mutex);
+  return rc;
+}
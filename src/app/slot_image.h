@@ -0,0 +1,122 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file slot_image.h
+ * @brief Memory-mapped bytecode slots
+ * @details Keeps the bytecode of each slot as a contiguous image in a
+ * dedicated flash partition, so the mruby/c VM can run it in place without
+ * copying it to RAM. Each slot has two banks; a new image is written to the
+ * bank the VM does not run from.
+ */
+#ifndef APP_SLOT_IMAGE_H
+#define APP_SLOT_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../lib/fn.h"
+#include "blink.h"
+
+/**
+ * @brief Number of banks of each slot
+ */
+#define SLOT_IMAGE_BANK_COUNT (2)
+
+/**
+ * @brief Magic number of a valid image header ("OBLK")
+ */
+#define SLOT_IMAGE_MAGIC (0x4B4C424FU)
+
+#pragma pack(1)
+/**
+ * @typedef slot_image_header_t
+ * @brief Header in front of the bytecode of a bank
+ * @details Written after the bytecode, so a bank is only valid once it is
+ * complete
+ */
+typedef struct {
+  uint32_t magic;    /**< SLOT_IMAGE_MAGIC if the bank is valid */
+  uint32_t sequence; /**< Incremented on each store, the newest bank wins */
+  uint16_t length;   /**< Length of the bytecode in bytes */
+  uint16_t crc;      /**< CRC16 of the bytecode */
+  uint32_t reserved; /**< Reserved, pads to the RRAM write block */
+} slot_image_header_t; /**< 16 bytes total */
+#pragma pack()
+
+/**
+ * @brief Initializes the slot partition
+ *
+ * @return fn_t kSuccess if successful, kFailure otherwise
+ */
+fn_t slot_image_init(void);
+
+/**
+ * @brief Maps the bytecode of a slot for execution in place
+ *
+ * @details The returned bank is not overwritten by later stores until the
+ * slot is mapped again, so the VM may run it until then.
+ *
+ * @param kSlot The slot to map
+ * @param length Set to the length of the bytecode
+ * @return const uint8_t* Memory-mapped bytecode, NULL if the slot is empty
+ */
+const uint8_t *slot_image_map(const blink_slot_t kSlot, size_t *const length);
+
+/**
+ * @brief Copies the bytecode of a slot
+ *
+ * @param kSlot The slot to read
+ * @param kOffset Offset in the bytecode to start copying from
+ * @param data Buffer to store the bytecode
+ * @param kLength Maximum length of the buffer
+ * @return ssize_t The length of the bytecode, -ENOENT if the slot is empty,
+ * or negative on error
+ */
+ssize_t slot_image_read(const blink_slot_t kSlot, const size_t kOffset,
+                        void *const data, const size_t kLength);
+
+/**
+ * @brief Stores bytecode to a slot
+ *
+ * @param kSlot The slot to store to
+ * @param kData Pointer to the bytecode data
+ * @param kLength Length of the bytecode data
+ * @return ssize_t The number of bytes written, 0 if the slot already holds
+ * the same bytecode, or negative on error
+ */
+ssize_t slot_image_write(const blink_slot_t kSlot, const void *const kData,
+                         const size_t kLength);
+
+/**
+ * @brief Gets the length of the bytecode of a slot
+ *
+ * @param kSlot The slot to check
+ * @return ssize_t The length of the bytecode, -ENOENT if the slot is empty,
+ * or negative on error
+ */
+ssize_t slot_image_get_length(const blink_slot_t kSlot);
+
+/**
+ * @brief Gets the CRC16 of the bytecode of a slot
+ *
+ * @param kSlot The slot to check
+ * @param crc Set to the CRC16 of the bytecode
+ * @return int 0 on success, -ENOENT if the slot is empty, or negative on
+ * error
+ */
+int slot_image_get_crc(const blink_slot_t kSlot, uint16_t *const crc);
+
+/**
+ * @brief Deletes the bytecode of a slot
+ *
+ * @details Only the headers are invalidated, so a mapped bank stays readable
+ *
+ * @param kSlot The slot to delete
+ * @return int 0 on success, negative on error
+ */
+int slot_image_delete(const blink_slot_t kSlot);
+
+#endif  // APP_SLOT_IMAGE_H
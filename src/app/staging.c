@@ -0,0 +1,494 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file staging.c
+ * @brief Implementation of the upload staging area
+ * @details Received bytes are passed to a stream_flash context, which writes a
+ * page to the blink_staging partition as soon as it is complete. The CRC16 is
+ * updated as the bytes arrive, so completing an upload only has to flush the
+ * last page. Data received past a gap is written straight to the partition
+ * and tracked as a range until the gap is filled. The partition is split into
+ * one area per session, so uploads over different connections do not
+ * interfere.
+ */
+#include "staging.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/storage/stream_flash.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/util.h>
+
+#include "blink.h"
+
+LOG_MODULE_REGISTER(app_staging, LOG_LEVEL_DBG);
+
+/** @brief Staging partition name */
+#define STAGING_PARTITION blink_staging
+
+/** @brief Memory-mapped address of the staging partition */
+#define STAGING_PARTITION_ADDRESS         \
+  (DT_REG_ADDR(DT_CHOSEN(zephyr_flash)) + \
+   FIXED_PARTITION_OFFSET(STAGING_PARTITION))
+
+/**
+ * @brief Size of the page buffer in bytes
+ * @details Multiple of the write block size of both flash and RRAM
+ */
+#define STAGING_PAGE_SIZE (256)
+
+/** @brief CRC16 polynomial of the Blink protocol */
+#define STAGING_CRC16_POLY (0xd175U)
+
+/** @brief CRC16 seed of the Blink protocol */
+#define STAGING_CRC16_SEED (0xFFFFU)
+
+/** @brief Size of the buffer used to merge a range into the stream */
+#define STAGING_MERGE_SIZE (64)
+
+/**
+ * @brief Smallest size of a session area in bytes
+ * @details The share of a session in the partition, rounded down to the
+ * erase page of the flash like in staging_init()
+ */
+#define STAGING_MIN_AREA_SIZE                                                 \
+  ROUND_DOWN(FIXED_PARTITION_SIZE(STAGING_PARTITION) / STAGING_SESSION_COUNT, \
+             DT_PROP_OR(DT_CHOSEN(zephyr_flash), erase_block_size, 4096))
+
+BUILD_ASSERT(BLINK_MAX_BYTECODE_SIZE <= STAGING_MIN_AREA_SIZE,
+             "blink_staging partition too small for the bytecode size");
+
+/**
+ * @typedef staging_session_t
+ * @brief Upload state of one session
+ */
+typedef struct {
+  uint8_t page[STAGING_PAGE_SIZE]; /**< Page buffer of the stream */
+  struct stream_flash_ctx ctx;     /**< Page-wise writer */
+  size_t offset;                   /**< Offset of the area in the partition */
+  size_t erased;                   /**< Bytes erased for the current upload */
+  size_t length;                   /**< Contiguous bytes staged */
+  uint16_t crc;                    /**< CRC16 of the staged bytes */
+  size_t range_count;              /**< Number of ranges past the gap */
+  /** Sorted, disjoint ranges past the gap */
+  staging_range_t ranges[STAGING_MAX_RANGES];
+} staging_session_t;
+
+/** @brief Staging state */
+static struct {
+  const struct flash_area *fa; /**< Staging partition */
+  bool explicit_erase;         /**< true if flash must be erased first */
+  size_t erase_page_size;      /**< Erase page size of the partition */
+  size_t area_size;            /**< Size of the area of each session */
+} staging;
+
+/** @brief Upload state of each session */
+static staging_session_t staging_sessions[STAGING_SESSION_COUNT];
+
+/**
+ * @brief Gets the upload state of a session
+ *
+ * @param kSession Session index
+ * @return staging_session_t* Upload state, NULL if the index is invalid or
+ * the partition is not open
+ */
+static staging_session_t *staging_get_session(const size_t kSession) {
+  if ((STAGING_SESSION_COUNT <= kSession) || (NULL == staging.fa)) {
+    return NULL;
+  }
+  return &staging_sessions[kSession];
+}
+
+/**
+ * @brief Erases the partition ahead of the stream if the flash requires it
+ *
+ * @param s Upload state of the session
+ * @param kEnd Offset up to which the partition must be writable
+ * @return int 0 on success, negative on error
+ */
+static int staging_prepare(staging_session_t *const s, const size_t kEnd) {
+  if (!staging.explicit_erase || (kEnd <= s->erased)) {
+    return 0;
+  }
+  const size_t kEraseEnd =
+      MIN(ROUND_UP(kEnd, staging.erase_page_size), staging.area_size);
+  int rc = flash_area_erase(staging.fa, s->offset + s->erased,
+                            kEraseEnd - s->erased);
+  if (0 != rc) {
+    LOG_ERR("staging erase failed, rc=%d", rc);
+    return rc;
+  }
+  s->erased = kEraseEnd;
+  return 0;
+}
+
+/**
+ * @brief Appends data to the contiguous part of the upload
+ *
+ * @param s Upload state of the session
+ * @param kData Pointer to the data to append
+ * @param kSize Size of the data
+ * @return int 0 on success, negative on error
+ */
+static int staging_append(staging_session_t *const s,
+                          const uint8_t *const kData, const size_t kSize) {
+  int rc = staging_prepare(s, s->length + kSize);
+  if (0 == rc) {
+    rc = stream_flash_buffered_write(&s->ctx, kData, kSize, false);
+  }
+  if (0 != rc) {
+    LOG_ERR("staging write failed, rc=%d", rc);
+    return rc;
+  }
+  s->crc = crc16_reflect(STAGING_CRC16_POLY, s->crc, kData, kSize);
+  s->length += kSize;
+  return 0;
+}
+
+/**
+ * @brief Writes data past the contiguous part and records its range
+ *
+ * @param s Upload state of the session
+ * @param kOffset Offset in the staged image
+ * @param kData Pointer to the data to write
+ * @param kLength Length of the data
+ * @return int 0 on success, -EINVAL if the data cannot be kept
+ */
+static int staging_write_ahead(staging_session_t *const s,
+                               const size_t kOffset, const void *const kData,
+                               const size_t kLength) {
+  // Erasing ahead of the stream would wipe the range again
+  if (staging.explicit_erase) {
+    return -EINVAL;
+  }
+
+  size_t start = kOffset;
+  size_t end = kOffset + kLength;
+  size_t first = 0;
+  while ((first < s->range_count) &&
+         (s->ranges[first].offset + s->ranges[first].size < start)) {
+    first++;
+  }
+  size_t last = first;
+  while ((last < s->range_count) && (s->ranges[last].offset <= end)) {
+    start = MIN(start, s->ranges[last].offset);
+    end = MAX(end, s->ranges[last].offset + s->ranges[last].size);
+    last++;
+  }
+  if ((first == last) && (STAGING_MAX_RANGES <= s->range_count)) {
+    return -EINVAL;
+  }
+  if ((last == first + 1) && (s->ranges[first].offset <= kOffset) &&
+      (kOffset + kLength <= s->ranges[first].offset + s->ranges[first].size)) {
+    return 0;  // Already staged
+  }
+
+  int rc = flash_area_write(staging.fa, s->offset + kOffset, kData, kLength);
+  if (0 != rc) {
+    LOG_ERR("staging write ahead failed, rc=%d", rc);
+    return -EINVAL;
+  }
+
+  // Replace ranges [first, last) by the merged range
+  if (first == last) {
+    memmove(&s->ranges[first + 1], &s->ranges[first],
+            (s->range_count - first) * sizeof(s->ranges[0]));
+    s->range_count++;
+  } else if (last > first + 1) {
+    memmove(&s->ranges[first + 1], &s->ranges[last],
+            (s->range_count - last) * sizeof(s->ranges[0]));
+    s->range_count -= last - first - 1;
+  }
+  s->ranges[first].offset = start;
+  s->ranges[first].size = end - start;
+  return 0;
+}
+
+/**
+ * @brief Moves ranges that became contiguous into the stream
+ *
+ * @details The bytes of a range are read back from the partition, so they are
+ * covered by the running CRC16 and rewritten with the same values.
+ *
+ * @param s Upload state of the session
+ * @return int 0 on success, negative on error
+ */
+static int staging_merge(staging_session_t *const s) {
+  uint8_t buf[STAGING_MERGE_SIZE];
+  while ((0 < s->range_count) && (s->ranges[0].offset <= s->length)) {
+    const size_t kEnd = s->ranges[0].offset + s->ranges[0].size;
+    while (s->length < kEnd) {
+      const size_t kSize = MIN(sizeof(buf), kEnd - s->length);
+      int rc = flash_area_read(staging.fa, s->offset + s->length, buf, kSize);
+      if (0 == rc) {
+        rc = staging_append(s, buf, kSize);
+      }
+      if (0 != rc) {
+        return rc;
+      }
+    }
+    s->range_count--;
+    memmove(&s->ranges[0], &s->ranges[1],
+            s->range_count * sizeof(s->ranges[0]));
+  }
+  return 0;
+}
+
+/**
+ * @brief Resets the stream of a session
+ *
+ * @param s Upload state of the session
+ */
+static void staging_reset_session(staging_session_t *const s) {
+  stream_flash_init(&s->ctx, staging.fa->fa_dev, s->page, sizeof(s->page),
+                    staging.fa->fa_off + s->offset, staging.area_size, NULL);
+  s->erased = 0;
+  s->length = 0;
+  s->crc = STAGING_CRC16_SEED;
+  s->range_count = 0;
+}
+
+/**
+ * @brief Initializes the staging area
+ *
+ * @return fn_t kSuccess if successful, kFailure otherwise
+ */
+fn_t staging_init(void) {
+  struct flash_pages_info info;
+  int rc = flash_area_open(FIXED_PARTITION_ID(STAGING_PARTITION), &staging.fa);
+  if (0 != rc) {
+    LOG_ERR("Unable to open staging partition, rc=%d", rc);
+    return kFailure;
+  }
+
+  rc = flash_get_page_info_by_offs(staging.fa->fa_dev, staging.fa->fa_off,
+                                   &info);
+  if (0 != rc) {
+    LOG_ERR("Unable to get page info, rc=%d", rc);
+    staging.fa = NULL;
+    return kFailure;
+  }
+  staging.erase_page_size = info.size;
+  staging.explicit_erase =
+      (0 != (flash_params_get_erase_cap(flash_get_parameters(
+                 staging.fa->fa_dev)) &
+             FLASH_ERASE_C_EXPLICIT));
+
+  // Areas start on an erase page boundary
+  staging.area_size = ROUND_DOWN(staging.fa->fa_size / STAGING_SESSION_COUNT,
+                                 staging.erase_page_size);
+  if (STAGING_PAGE_SIZE > staging.area_size) {
+    LOG_ERR("Staging partition too small for %d sessions",
+            STAGING_SESSION_COUNT);
+    staging.fa = NULL;
+    return kFailure;
+  }
+  for (size_t i = 0; i < STAGING_SESSION_COUNT; i++) {
+    staging_sessions[i].offset = i * staging.area_size;
+    staging_reset_session(&staging_sessions[i]);
+  }
+  LOG_DBG("staging: %d sessions of %d bytes", STAGING_SESSION_COUNT,
+          staging.area_size);
+  return kSuccess;
+}
+
+/**
+ * @brief Discards the current upload of a session
+ *
+ * @param kSession Session index
+ */
+void staging_reset(const size_t kSession) {
+  staging_session_t *const s = staging_get_session(kSession);
+  if (NULL != s) {
+    staging_reset_session(s);
+  }
+}
+
+/**
+ * @brief Writes data to the staging area of a session
+ *
+ * @details A write never starts a new upload, not even at offset 0, so data
+ * that is received repeatedly in any order can be collected. The caller
+ * decides when an upload starts and calls staging_reset() then.
+ *
+ * @param kSession Session index
+ * @param kOffset Offset in the staged image
+ * @param kData Pointer to the data to write
+ * @param kLength Length of the data
+ * @return int 0 on success, -EINVAL if data past a gap cannot be kept, other
+ * negative values on flash errors
+ */
+int staging_write(const size_t kSession, const size_t kOffset,
+                  const void *const kData, const size_t kLength) {
+  staging_session_t *const s = staging_get_session(kSession);
+  if (NULL == s) {
+    return -ENODEV;
+  }
+  if (kOffset + kLength > staging.area_size) {
+    return -ENOSPC;
+  }
+  if (kOffset > s->length) {
+    const int kRc = staging_write_ahead(s, kOffset, kData, kLength);
+    if (0 != kRc) {
+      LOG_WRN("staging gap %d..%d", s->length, kOffset);
+    }
+    return kRc;
+  }
+  if (kOffset + kLength <= s->length) {
+    return 0;  // Already staged
+  }
+
+  // Skip the bytes that were already staged
+  const size_t kSkip = s->length - kOffset;
+  int rc = staging_append(s, (const uint8_t *)kData + kSkip, kLength - kSkip);
+  if (0 == rc) {
+    rc = staging_merge(s);
+  }
+  return rc;
+}
+
+/**
+ * @brief Reads back data of the current upload of a session
+ *
+ * @details Bytes that are still in the page buffer are read from RAM, the
+ * others from the partition.
+ *
+ * @param kSession Session index
+ * @param kOffset Offset in the staged image
+ * @param data Buffer to store the read data
+ * @param kLength Length of the data
+ * @return int 0 on success, negative on error
+ */
+int staging_read(const size_t kSession, const size_t kOffset, void *const data,
+                 const size_t kLength) {
+  staging_session_t *const s = staging_get_session(kSession);
+  if ((NULL == s) || (kOffset + kLength > s->length)) {
+    return -EINVAL;
+  }
+  const size_t kFlushed = stream_flash_bytes_written(&s->ctx);
+  uint8_t *dst = (uint8_t *)data;
+  size_t offset = kOffset;
+  size_t remaining = kLength;
+
+  if (offset < kFlushed) {
+    const size_t kSize = MIN(remaining, kFlushed - offset);
+    int rc = flash_area_read(staging.fa, s->offset + offset, dst, kSize);
+    if (0 != rc) {
+      return rc;
+    }
+    dst += kSize;
+    offset += kSize;
+    remaining -= kSize;
+  }
+  if (0 < remaining) {
+    memcpy(dst, &s->page[offset - kFlushed], remaining);
+  }
+  return 0;
+}
+
+/**
+ * @brief Completes the current upload of a session
+ *
+ * @param kSession Session index
+ * @param kLength Expected length of the staged image
+ * @param crc Pointer to store the CRC16 of the staged image
+ * @return int 0 on success, -ENODATA if the staged length differs, other
+ * negative values on flash errors
+ */
+int staging_finish(const size_t kSession, const size_t kLength,
+                   uint16_t *const crc) {
+  staging_session_t *const s = staging_get_session(kSession);
+  if (NULL == s) {
+    return -ENODEV;
+  }
+  if (kLength != s->length) {
+    LOG_ERR("staging length %d != %d", s->length, kLength);
+    return -ENODATA;
+  }
+  int rc = stream_flash_buffered_write(&s->ctx, NULL, 0, true);
+  if (0 != rc) {
+    LOG_ERR("staging flush failed, rc=%d", rc);
+    return rc;
+  }
+  *crc = s->crc;
+  return 0;
+}
+
+/**
+ * @brief Lists the byte ranges that are still missing in a session
+ *
+ * @param kSession Session index
+ * @param kLength Expected length of the staged image
+ * @param ranges Array to store the missing ranges
+ * @param kMaxRanges Size of the array
+ * @return size_t Number of missing ranges stored
+ */
+size_t staging_get_missing(const size_t kSession, const size_t kLength,
+                           staging_range_t *const ranges,
+                           const size_t kMaxRanges) {
+  const staging_session_t *const s = staging_get_session(kSession);
+  if (NULL == s) {
+    return 0;
+  }
+  size_t count = 0;
+  size_t offset = s->length;
+  for (size_t i = 0;
+       (i <= s->range_count) && (offset < kLength) && (count < kMaxRanges);
+       i++) {
+    const size_t kEnd =
+        (i < s->range_count) ? MIN(s->ranges[i].offset, kLength) : kLength;
+    if (offset < kEnd) {
+      ranges[count].offset = offset;
+      ranges[count].size = kEnd - offset;
+      count++;
+    }
+    if (i < s->range_count) {
+      offset = MAX(offset, s->ranges[i].offset + s->ranges[i].size);
+    }
+  }
+  return count;
+}
+
+/**
+ * @brief Gets the number of contiguous bytes staged so far in a session
+ *
+ * @param kSession Session index
+ * @return size_t Length of the staged image
+ */
+size_t staging_get_length(const size_t kSession) {
+  const staging_session_t *const s = staging_get_session(kSession);
+  return (NULL != s) ? s->length : 0;
+}
+
+/**
+ * @brief Checks whether data written past a gap is kept
+ *
+ * @details Writing ahead of the stream on flash with explicit erase would
+ * need the page to be erased again when the stream reaches it, and flash
+ * words can only be written a limited number of times between erases, so
+ * such flash drops the data instead of buffering it.
+ *
+ * @return true if data past a gap is kept as a separate range
+ */
+bool staging_keeps_ranges(void) { return !staging.explicit_erase; }
+
+/**
+ * @brief Gets the memory-mapped staged image of a session
+ *
+ * @param kSession Session index
+ * @return const uint8_t* Pointer to the start of the area of the session
+ */
+const uint8_t *staging_get_image(const size_t kSession) {
+  const staging_session_t *const s = staging_get_session(kSession);
+  if (NULL == s) {
+    return NULL;
+  }
+  return (const uint8_t *)STAGING_PARTITION_ADDRESS + s->offset;
+}
@@ -0,0 +1,139 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file staging.h
+ * @brief Upload staging area
+ * @details Streams received bytecode into a dedicated flash partition while
+ * keeping a running CRC16, so an upload needs no RAM image buffer. Each
+ * session has its own area of the partition and its own upload state.
+ */
+#ifndef APP_STAGING_H
+#define APP_STAGING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../lib/fn.h"
+
+/**
+ * @brief Number of sessions that can stage an upload at the same time
+ */
+#define STAGING_SESSION_COUNT (4)
+
+/**
+ * @brief Maximum number of byte ranges held ahead of the contiguous data
+ */
+#define STAGING_MAX_RANGES (16)
+
+/**
+ * @typedef staging_range_t
+ * @brief Byte range of the staged image
+ */
+typedef struct {
+  size_t offset; /**< Offset of the range */
+  size_t size;   /**< Size of the range */
+} staging_range_t;
+
+/**
+ * @brief Initializes the staging area
+ *
+ * @return fn_t kSuccess if successful, kFailure otherwise
+ */
+fn_t staging_init(void);
+
+/**
+ * @brief Discards the current upload of a session
+ *
+ * @param kSession Session index
+ */
+void staging_reset(const size_t kSession);
+
+/**
+ * @brief Writes data to the staging area of a session
+ *
+ * @details A write never starts a new upload, not even at offset 0; call
+ * staging_reset() for that. Bytes that were already staged are skipped, so
+ * data may be written repeatedly. Data written past the contiguous part is
+ * kept as a separate range if the flash needs no erase before writing, and
+ * merged once the gap in front of it is filled.
+ *
+ * @param kSession Session index
+ * @param kOffset Offset in the staged image
+ * @param kData Pointer to the data to write
+ * @param kLength Length of the data
+ * @return int 0 on success, -EINVAL if data past a gap cannot be kept, other
+ * negative values on flash errors
+ */
+int staging_write(const size_t kSession, const size_t kOffset,
+                  const void *const kData, const size_t kLength);
+
+/**
+ * @brief Reads back data of the current upload of a session
+ *
+ * @param kSession Session index
+ * @param kOffset Offset in the staged image
+ * @param data Buffer to store the read data
+ * @param kLength Length of the data
+ * @return int 0 on success, negative on error
+ */
+int staging_read(const size_t kSession, const size_t kOffset, void *const data,
+                 const size_t kLength);
+
+/**
+ * @brief Completes the current upload of a session
+ *
+ * @details Flushes the pending page and returns the CRC16 of the staged image.
+ *
+ * @param kSession Session index
+ * @param kLength Expected length of the staged image
+ * @param crc Pointer to store the CRC16 of the staged image
+ * @return int 0 on success, -ENODATA if the staged length differs, other
+ * negative values on flash errors
+ */
+int staging_finish(const size_t kSession, const size_t kLength,
+                   uint16_t *const crc);
+
+/**
+ * @brief Lists the byte ranges that are still missing in a session
+ *
+ * @param kSession Session index
+ * @param kLength Expected length of the staged image
+ * @param ranges Array to store the missing ranges
+ * @param kMaxRanges Size of the array
+ * @return size_t Number of missing ranges stored
+ */
+size_t staging_get_missing(const size_t kSession, const size_t kLength,
+                           staging_range_t *const ranges,
+                           const size_t kMaxRanges);
+
+/**
+ * @brief Gets the number of contiguous bytes staged so far in a session
+ *
+ * @param kSession Session index
+ * @return size_t Length of the staged image
+ */
+size_t staging_get_length(const size_t kSession);
+
+/**
+ * @brief Checks whether data written past a gap is kept
+ *
+ * @details Only flash that needs no erase before writing, such as RRAM, can
+ * keep such data. Otherwise it is dropped and must be resent in order.
+ *
+ * @return true if data past a gap is kept as a separate range
+ */
+bool staging_keeps_ranges(void);
+
+/**
+ * @brief Gets the memory-mapped staged image of a session
+ *
+ * @param kSession Session index
+ * @return const uint8_t* Pointer to the start of the area of the session
+ */
+const uint8_t *staging_get_image(const size_t kSession);
+
+#endif  // APP_STAGING_H
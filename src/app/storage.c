@@ -38,6 +38,9 @@ K_MUTEX_DEFINE(mutex_storage);
 /** @brief ZMS filesystem structure */
 static struct zms_fs fs;
 
+/** @brief Free space in zms_storage at the last storage_free_space() call */
+static ssize_t free_space = 0;
+
 /**
  * @brief Initializes the storage subsystem
  *
@@ -151,7 +154,8 @@ int storage_delete(const storage_id_t kId) {
  * @brief Logs information about free space in storage
  *
  * @details Calculates and logs free space for both zms_storage and
- * settings_storage
+ * settings_storage. Both walk the allocation tables, so the result for
+ * zms_storage is kept for storage_get_free_space().
  *
  * @return ssize_t Free space in bytes for zms_storage
  */
@@ -159,6 +163,7 @@ ssize_t storage_free_space(void) {
   // zms_storage
   const ssize_t kRc = zms_calc_free_space(&fs);
   LOG_INF("zms_storage: %zu bytes free", kRc);
+  free_space = kRc;
 
   // settings_storage
   struct zms_fs *fs_settings;
@@ -173,6 +178,14 @@ ssize_t storage_free_space(void) {
   return kRc;  // zm_storage
 }
 
+/**
+ * @brief Gets the free space in storage without recalculating it
+ *
+ * @return ssize_t Free space in bytes for zms_storage at the last
+ * storage_free_space() call
+ */
+ssize_t storage_get_free_space(void) { return free_space; }
+
 /**
  * @brief Gets the maximum data size that can be stored
  *
@@ -24,6 +24,9 @@
 typedef enum {
   kStorageBlinkSlot1 = 1U, /**< Storage ID for first blink slot */
   kStorageBlinkSlot2 = 2U, /**< Storage ID for second blink slot */
+  kStorageBlinkSlot3 = 3U, /**< Storage ID for third blink slot */
+  kStorageBlinkSlot4 = 4U, /**< Storage ID for fourth blink slot */
+  kStorageBlinkSlot5 = 5U, /**< Storage ID for fifth blink slot */
 } storage_id_t;
 
 /**
@@ -90,6 +93,14 @@ int storage_delete(const storage_id_t kId);
  */
 ssize_t storage_free_space(void);
 
+/**
+ * @brief Gets the free space in storage without recalculating it
+ *
+ * @return ssize_t Free space in bytes for zms_storage at the last
+ * storage_free_space() call
+ */
+ssize_t storage_get_free_space(void);
+
 /**
  * @brief Gets the maximum data size that can be stored
  *
@@ -25,21 +25,128 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/settings/settings.h>
+#include <zephyr/sys/byteorder.h>
 #include <zephyr/sys/util.h>
 
 #include "../app/comm.h"
+#include "app_version.h"
 #include "ble_blink.h"
+#include "ble_broadcast.h"
+#include "ble_l2cap.h"
 
 LOG_MODULE_REGISTER(drv_ble, LOG_LEVEL_DBG);
 
 /** @brief Global BLE context */
 BLE_CONTEXT ble_context;
 
+/** @brief Protects the connections of the context against work handlers */
+static struct k_spinlock ble_conn_lock;
+
 /** @brief Semaphore for BLE initialization synchronization */
 static K_SEM_DEFINE(ble_init_ok, 0, 1);
 
-/** @brief MTU exchange parameters */
-static struct bt_gatt_exchange_params exchange_params;
+/** @brief MTU exchange parameters of each connection */
+static struct bt_gatt_exchange_params exchange_params[BLE_MAX_CONN];
+
+/** @brief Minimum interval of the upload phase (7.5 ms, 1.25 ms units) */
+#define BLE_POLICY_UPLOAD_INTERVAL_MIN 6
+/**
+ * @brief Maximum interval of the upload phase (15 ms)
+ * @details Also the fixed interval requested when the central rejects the
+ * range, since iOS accepts 15 ms but no minimum below it
+ */
+#define BLE_POLICY_UPLOAD_INTERVAL_MAX 12
+/** @brief Minimum connection interval of the idle phase (100 ms) */
+#define BLE_POLICY_IDLE_INTERVAL_MIN 80
+/** @brief Maximum connection interval of the idle phase (200 ms) */
+#define BLE_POLICY_IDLE_INTERVAL_MAX 160
+/** @brief Peripheral latency of the idle phase */
+#define BLE_POLICY_IDLE_LATENCY 4
+/** @brief Supervision timeout of both phases (4 s, 10 ms units) */
+#define BLE_POLICY_TIMEOUT 400
+/** @brief Time without upload traffic before the idle phase (ms) */
+#define BLE_POLICY_IDLE_DELAY_MS 3000
+/** @brief Time the central has to apply the upload interval (ms) */
+#define BLE_POLICY_FALLBACK_DELAY_MS 1000
+
+/**
+ * @typedef ble_phase_t
+ * @brief Link phases of the connection policy
+ */
+typedef enum {
+  kBlePhaseIdle,   /**< Long interval with peripheral latency */
+  kBlePhaseUpload, /**< Short interval, 2M PHY and maximum data length */
+} ble_phase_t;
+
+/**
+ * @brief Connection policy state of a connection
+ */
+typedef struct {
+  volatile ble_phase_t phase;            /**< Current link phase */
+  struct k_work upload_work;             /**< Enters the upload phase */
+  struct k_work_delayable fallback_work; /**< Retries with 15 ms */
+  struct k_work_delayable idle_work;     /**< Enters the idle phase */
+} ble_policy_t;
+
+/** @brief Connection policy state indexed by bt_conn_index() */
+static ble_policy_t ble_policy[BLE_MAX_CONN];
+
+/**
+ * @brief Restarts advertising while a connection slot is free
+ *
+ * @param work Work item that triggered the handler
+ */
+static void ble_advertise(struct k_work *work);
+
+/** @brief Work item that restarts advertising */
+static K_WORK_DEFINE(ble_advertise_work, ble_advertise);
+
+/**
+ * @brief Counts the active connections
+ *
+ * @return uint8_t Number of connections
+ */
+static uint8_t ble_count_connections(void) {
+  uint8_t count = 0;
+  for (size_t i = 0; i < BLE_MAX_CONN; i++) {
+    if (NULL != ble_context.conn[i]) {
+      count++;
+    }
+  }
+  return count;
+}
+
+/**
+ * @brief Gets a reference to a connection
+ *
+ * @details Takes the reference under the lock that on_disconnected() clears
+ * the connection with, so a work handler cannot pick up a connection that
+ * is being released. A connection that is no longer connected is not
+ * returned.
+ *
+ * @param kIndex Index of the connection from bt_conn_index()
+ * @return struct bt_conn* Connection to release with bt_conn_unref(), or
+ * NULL if there is none
+ */
+struct bt_conn *ble_get_conn(const size_t kIndex) {
+  if (BLE_MAX_CONN <= kIndex) {
+    return NULL;
+  }
+  k_spinlock_key_t key = k_spin_lock(&ble_conn_lock);
+  struct bt_conn *conn = ble_context.conn[kIndex];
+  if (NULL != conn) {
+    bt_conn_ref(conn);
+  }
+  k_spin_unlock(&ble_conn_lock, key);
+
+  struct bt_conn_info info;
+  if ((NULL != conn) && ((0 != bt_conn_get_info(conn, &info)) ||
+                         (BT_CONN_STATE_CONNECTED != info.state))) {
+    bt_conn_unref(conn);
+    conn = NULL;
+  }
+  return conn;
+}
 
 /**
  * @brief Callback for MTU exchange completion
@@ -58,6 +165,118 @@ static void mtu_exchange_cb(struct bt_conn *conn, uint8_t err,
   printk("Negotiated MTU: %u\n", mtu);
 }
 
+/**
+ * @brief Requests the link settings of the upload phase
+ *
+ * @details Runs on the system work queue, so the HCI commands are not issued
+ * from the BT RX thread that delivered the write.
+ *
+ * @param work Work item that triggered the handler
+ */
+static void ble_policy_upload(struct k_work *work) {
+  ble_policy_t *policy = CONTAINER_OF(work, ble_policy_t, upload_work);
+  struct bt_conn *conn = ble_get_conn(policy - ble_policy);
+  if (NULL == conn) {
+    return;
+  }
+  int err = bt_conn_le_param_update(
+      conn, BT_LE_CONN_PARAM(BLE_POLICY_UPLOAD_INTERVAL_MIN,
+                             BLE_POLICY_UPLOAD_INTERVAL_MAX, 0,
+                             BLE_POLICY_TIMEOUT));
+  if (err) {
+    LOG_WRN("BLE: upload conn param request failed (err %d)", err);
+  } else {
+    k_work_reschedule(&policy->fallback_work,
+                      K_MSEC(BLE_POLICY_FALLBACK_DELAY_MS));
+  }
+  err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+  if (err) {
+    LOG_WRN("BLE: 2M PHY request failed (err %d)", err);
+  }
+  err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+  if (err) {
+    LOG_WRN("BLE: data length request failed (err %d)", err);
+  }
+  bt_conn_unref(conn);
+}
+
+/**
+ * @brief Requests a fixed 15 ms interval if the upload range was not applied
+ *
+ * @details A central that rejects the range of the upload phase, such as iOS
+ * for a minimum below 15 ms, leaves the interval unchanged and does not report
+ * the rejection, so the interval is checked after
+ * BLE_POLICY_FALLBACK_DELAY_MS.
+ *
+ * @param work Work item that triggered the handler
+ */
+static void ble_policy_fallback(struct k_work *work) {
+  struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+  ble_policy_t *policy = CONTAINER_OF(dwork, ble_policy_t, fallback_work);
+  struct bt_conn *conn = ble_get_conn(policy - ble_policy);
+  if (NULL == conn) {
+    return;
+  }
+  struct bt_conn_info info;
+  if ((kBlePhaseUpload == policy->phase) &&
+      (0 == bt_conn_get_info(conn, &info)) &&
+      (BLE_POLICY_UPLOAD_INTERVAL_MAX < info.le.interval)) {
+    int err = bt_conn_le_param_update(
+        conn, BT_LE_CONN_PARAM(BLE_POLICY_UPLOAD_INTERVAL_MAX,
+                               BLE_POLICY_UPLOAD_INTERVAL_MAX, 0,
+                               BLE_POLICY_TIMEOUT));
+    if (err) {
+      LOG_WRN("BLE: fallback conn param request failed (err %d)", err);
+    }
+  }
+  bt_conn_unref(conn);
+}
+
+/**
+ * @brief Requests the link settings of the idle phase
+ *
+ * @details The PHY and data length of the upload phase are kept, since they
+ * do not cost current while the link is quiet.
+ *
+ * @param work Work item that triggered the handler
+ */
+static void ble_policy_idle(struct k_work *work) {
+  struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+  ble_policy_t *policy = CONTAINER_OF(dwork, ble_policy_t, idle_work);
+  struct bt_conn *conn = ble_get_conn(policy - ble_policy);
+  policy->phase = kBlePhaseIdle;
+  k_work_cancel_delayable(&policy->fallback_work);
+  if (NULL == conn) {
+    return;
+  }
+  int err = bt_conn_le_param_update(
+      conn, BT_LE_CONN_PARAM(BLE_POLICY_IDLE_INTERVAL_MIN,
+                             BLE_POLICY_IDLE_INTERVAL_MAX,
+                             BLE_POLICY_IDLE_LATENCY, BLE_POLICY_TIMEOUT));
+  if (err) {
+    LOG_WRN("BLE: idle conn param request failed (err %d)", err);
+  }
+  bt_conn_unref(conn);
+}
+
+/**
+ * @brief Restarts advertising while a connection slot is free
+ *
+ * @details Connectable advertising stops when a central connects, so it is
+ * restarted to let another central connect.
+ *
+ * @param work Work item that triggered the handler
+ */
+static void ble_advertise(struct k_work *work) {
+  if (BLE_MAX_CONN <= ble_count_connections()) {
+    return;
+  }
+  int err = ble_start_advertising(bt_get_name());
+  if ((0 != err) && (-EALREADY != err)) {
+    LOG_WRN("BLE: advertising restart failed (err %d)", err);
+  }
+}
+
 /**
  * @brief Connection callback
  *
@@ -75,10 +294,20 @@ static void on_connected(struct bt_conn *conn, uint8_t err) {
   } else if (bt_conn_get_info(conn, &info)) {
     LOG_ERR("BLE: Could not parse connection info");
   } else {
-    ble_context.conn = conn;
-
-    exchange_params.func = mtu_exchange_cb;
-    int ret = bt_gatt_exchange_mtu(conn, &exchange_params);
+    const uint8_t kIndex = bt_conn_index(conn);
+    k_spinlock_key_t key = k_spin_lock(&ble_conn_lock);
+    ble_context.conn[kIndex] = bt_conn_ref(conn);
+    k_spin_unlock(&ble_conn_lock, key);
+    ble_blink_connected(conn);
+
+    // The central picks the initial parameters and may change them until
+    // the first upload; go idle if nothing happens
+    ble_policy[kIndex].phase = kBlePhaseIdle;
+    k_work_reschedule(&ble_policy[kIndex].idle_work,
+                      K_MSEC(BLE_POLICY_IDLE_DELAY_MS));
+
+    exchange_params[kIndex].func = mtu_exchange_cb;
+    int ret = bt_gatt_exchange_mtu(conn, &exchange_params[kIndex]);
     if (ret) {
       printk("Failed start MTU exchange (err %d)\n", ret);
     }
@@ -96,9 +325,14 @@ static void on_connected(struct bt_conn *conn, uint8_t err) {
     {
       BLE_PARAM param = {
           .event = BLE_EVENT_CONNECTED,
+          .connected.count = ble_count_connections(),
       };
       ble_context.event_cb(&param);
     }
+    k_work_submit(&ble_advertise_work);
+    if (IS_ENABLED(CONFIG_OPENBLINK_BROADCAST_RECEIVE)) {
+      ble_broadcast_enable(false);
+    }
   }
 }
 
@@ -111,19 +345,47 @@ static void on_connected(struct bt_conn *conn, uint8_t err) {
  * @param reason Reason for disconnection
  */
 static void on_disconnected(struct bt_conn *conn, uint8_t reason) {
+  const uint8_t kIndex = bt_conn_index(conn);
+  if (conn != ble_context.conn[kIndex]) {
+    return;
+  }
+  k_work_cancel_delayable(&ble_policy[kIndex].idle_work);
+  k_work_cancel_delayable(&ble_policy[kIndex].fallback_work);
+  ble_policy[kIndex].phase = kBlePhaseIdle;
+  ble_blink_disconnected(conn);
+  k_spinlock_key_t key = k_spin_lock(&ble_conn_lock);
+  ble_context.conn[kIndex] = NULL;
+  k_spin_unlock(&ble_conn_lock, key);
+  bt_conn_unref(conn);
   {
     BLE_PARAM param = {
         .event = BLE_EVENT_DISCONNECTED,
         .disconnected.reason = reason,
+        .disconnected.count = ble_count_connections(),
     };
     ble_context.event_cb(&param);
   }
+  if (IS_ENABLED(CONFIG_OPENBLINK_BROADCAST_RECEIVE) &&
+      (0 == ble_count_connections())) {
+    ble_broadcast_enable(true);
+  }
 }
 
+/**
+ * @brief Connection object recycled callback
+ *
+ * @details Called when the connection object of a terminated connection can
+ * be reused, so advertising can be restarted.
+ */
+static void on_recycled(void) { k_work_submit(&ble_advertise_work); }
+
 /**
  * @brief Connection parameter request callback
  *
- * @details Called when a remote device requests connection parameter update
+ * @details Called when a remote device requests connection parameter update.
+ * While upload traffic flows, requests for an interval above the upload range
+ * are rejected. Until the first upload of a connection, every request is
+ * accepted.
  *
  * @param conn Bluetooth connection handle
  * @param param Requested connection parameters
@@ -131,7 +393,11 @@ static void on_disconnected(struct bt_conn *conn, uint8_t reason) {
  */
 static bool on_le_param_req(struct bt_conn *conn,
                             struct bt_le_conn_param *param) {
-  // If acceptable params, return true, otherwise return false.
+  if ((kBlePhaseUpload == ble_policy[bt_conn_index(conn)].phase) &&
+      (param->interval_min > BLE_POLICY_UPLOAD_INTERVAL_MAX)) {
+    LOG_DBG("BLE: conn param request rejected during upload");
+    return false;
+  }
   return true;
 }
 
@@ -165,6 +431,52 @@ static void on_le_param_updated(struct bt_conn *conn, uint16_t interval,
   }
 }
 
+/**
+ * @brief Security change callback
+ *
+ * @details Called when encryption of the link starts or fails. A bonded
+ * central reaches this without pairing again.
+ *
+ * @param conn Bluetooth connection handle
+ * @param level New security level
+ * @param err Security error (BT_SECURITY_ERR_SUCCESS for success)
+ */
+static void on_security_changed(struct bt_conn *conn, bt_security_t level,
+                                enum bt_security_err err) {
+  if (err) {
+    LOG_WRN("BLE: security failed: level %d (err %d)", level, err);
+  } else {
+    LOG_DBG("BLE: security changed: level %d", level);
+  }
+}
+
+/**
+ * @brief Pairing completion callback
+ *
+ * @param conn Bluetooth connection handle
+ * @param bonded true if the bond was stored
+ */
+static void on_pairing_complete(struct bt_conn *conn, bool bonded) {
+  LOG_INF("BLE: pairing complete (bonded:%d)", bonded);
+}
+
+/**
+ * @brief Pairing failure callback
+ *
+ * @param conn Bluetooth connection handle
+ * @param reason Reason for the failure
+ */
+static void on_pairing_failed(struct bt_conn *conn,
+                              enum bt_security_err reason) {
+  LOG_WRN("BLE: pairing failed (reason %d)", reason);
+}
+
+/** @brief Pairing result callbacks of the bonded mode */
+static struct bt_conn_auth_info_cb auth_info_callbacks = {
+    .pairing_complete = on_pairing_complete,
+    .pairing_failed = on_pairing_failed,
+};
+
 /**
  * @brief Converts PHY value to string representation
  *
@@ -236,10 +548,12 @@ static void bt_ready(int err) {
   BT_CONN_CB_DEFINE(conn_callbacks) = {
       .connected = on_connected,
       .disconnected = on_disconnected,
+      .recycled = on_recycled,
       .le_param_req = on_le_param_req,
       .le_param_updated = on_le_param_updated,
       .le_phy_updated = on_le_phy_updated,
       .le_data_len_updated = on_le_data_length_updated,
+      .security_changed = on_security_changed,
   };
 
   // Complete the initialization
@@ -250,7 +564,7 @@ static void bt_ready(int err) {
  * @brief Initializes the BLE subsystem
  *
  * @details Sets up the BLE stack, registers callbacks, and initializes the
- * Blink service
+ * Blink service and its L2CAP channel
  *
  * @param cb Callback function for BLE events
  * @return int 0 on success, negative on error
@@ -264,7 +578,21 @@ int ble_init(BLE_CALLBACK cb) {
   // Save callback
   ble_context.event_cb = cb;
 
+  for (size_t i = 0; i < BLE_MAX_CONN; i++) {
+    ble_policy[i].phase = kBlePhaseIdle;
+    k_work_init(&ble_policy[i].upload_work, ble_policy_upload);
+    k_work_init_delayable(&ble_policy[i].fallback_work, ble_policy_fallback);
+    k_work_init_delayable(&ble_policy[i].idle_work, ble_policy_idle);
+  }
+
+  // The service is registered before settings_load(), so the database hash
+  // matches the stored one and bonded clients keep their GATT cache
   ble_blink_init();
+  ble_l2cap_init();
+
+  if (IS_ENABLED(CONFIG_BT_BONDABLE)) {
+    bt_conn_auth_info_cb_register(&auth_info_callbacks);
+  }
 
   // Enable Bluetooth
   LOG_DBG("BLE: bt_enable()");
@@ -287,21 +615,32 @@ int ble_init(BLE_CALLBACK cb) {
     ble_context.event_cb(&param);
   }
 
+  // Listen for broadcasts until a central connects
+  if (IS_ENABLED(CONFIG_OPENBLINK_BROADCAST_RECEIVE)) {
+    ble_broadcast_enable(true);
+  }
+
   return err;
 }
 
 /**
- * @brief Disconnects the current BLE connection
+ * @brief Disconnects all BLE connections
  *
  * @return int 0 on success, negative on error
  */
 int ble_disconnect() {
   LOG_INF("BLE: Disconnecting...");
   int err = 0;
-  if (ble_context.conn != NULL) {
-    bt_conn_disconnect(ble_context.conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
-    if (err) {
-      LOG_ERR("BLE: Failed to disconnect (err %d)", err);
+  for (size_t i = 0; i < BLE_MAX_CONN; i++) {
+    struct bt_conn *conn = ble_get_conn(i);
+    if (conn != NULL) {
+      const int kErr =
+          bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+      if (kErr) {
+        LOG_ERR("BLE: Failed to disconnect (err %d)", kErr);
+        err = kErr;
+      }
+      bt_conn_unref(conn);
     }
   }
   return err;
@@ -317,12 +656,38 @@ static const struct bt_le_adv_param adv_param = BT_LE_ADV_PARAM_INIT(
     BT_GAP_ADV_FAST_INT_MAX_2,  // Advertisement interval (150ms)
     NULL);
 
+/**
+ * @brief Manufacturer data of the scan response
+ * @details Lets a host see the firmware version and the stored programs
+ * without connecting
+ */
+#pragma pack(1)
+typedef struct {
+  uint16_t company;      /**< Company identifier (BLE_COMPANY_ID) */
+  uint8_t version_major; /**< Firmware major version */
+  uint8_t version_minor; /**< Firmware minor version */
+  uint8_t patchlevel;    /**< Firmware patch level */
+  /** CRC16 of the stored bytecode of each slot, 0 until it is known */
+  uint16_t slot_crc[BLE_ADV_SLOT_COUNT];
+} BLE_ADV_MANUFACTURER; /**< 9 bytes total */
+#pragma pack()
+
+/** @brief Advertised manufacturer data */
+static BLE_ADV_MANUFACTURER ble_adv_manufacturer = {
+    .company = sys_cpu_to_le16(BLE_COMPANY_ID),
+    .version_major = APP_VERSION_MAJOR,
+    .version_minor = APP_VERSION_MINOR,
+    .patchlevel = APP_PATCHLEVEL,
+};
+
 /**
  * @brief Scan response data
- * @details Includes the OpenBlink service UUID
+ * @details Includes the OpenBlink service UUID and the manufacturer data
  */
 static const struct bt_data sd[] = {
     BT_DATA_BYTES(BT_DATA_UUID128_ALL, OPENBLINK_SERVICE_UUID),
+    BT_DATA(BT_DATA_MANUFACTURER_DATA, &ble_adv_manufacturer,
+            sizeof(ble_adv_manufacturer)),
 };
 
 /**
@@ -368,8 +733,65 @@ int ble_stop_advertising() {
 }
 
 /**
- * @brief Gets the current Maximum Transmission Unit (MTU)
+ * @brief Reports upload traffic to the connection policy
+ *
+ * @details The first call after an idle period requests a 7.5-15 ms interval,
+ * 2M PHY and maximum data length. Without further calls the link returns to
+ * a long interval with peripheral latency after BLE_POLICY_IDLE_DELAY_MS.
+ * Each connection has its own phase.
  *
- * @return uint16_t Current MTU size in bytes
+ * @param conn Connection that carried the upload
  */
-uint16_t ble_get_mtu() { return bt_gatt_get_mtu(ble_context.conn); }
+void ble_policy_activity(struct bt_conn *conn) {
+  if (NULL == conn) {
+    return;
+  }
+  ble_policy_t *policy = &ble_policy[bt_conn_index(conn)];
+  if (kBlePhaseUpload != policy->phase) {
+    policy->phase = kBlePhaseUpload;
+    k_work_submit(&policy->upload_work);
+  }
+  k_work_reschedule(&policy->idle_work, K_MSEC(BLE_POLICY_IDLE_DELAY_MS));
+}
+
+/**
+ * @brief Applies the manufacturer data to the running advertising
+ *
+ * @details Runs on the system work queue, so the HCI commands are not issued
+ * from the BT RX thread that committed a program. Without advertising, the
+ * data is used the next time advertising starts.
+ *
+ * @param work Work item that triggered the handler
+ */
+static void ble_adv_update(struct k_work *work) {
+  const char *name = bt_get_name();
+  const struct bt_data ad[] = {
+      BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR),
+      BT_DATA(BT_DATA_NAME_COMPLETE, name, strlen(name)),
+  };
+  int err = bt_le_adv_update_data(ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+  if ((0 != err) && (-EAGAIN != err)) {
+    LOG_WRN("BLE: advertising data update failed (err %d)", err);
+  }
+}
+
+/** @brief Work item that updates the advertising data */
+static K_WORK_DEFINE(ble_adv_update_work, ble_adv_update);
+
+/**
+ * @brief Advertises the CRC16 of the stored bytecode of a slot
+ *
+ * @details A fleet tool can compare the CRC16 with its own and connect only
+ * to devices whose program differs. Slots past BLE_ADV_SLOT_COUNT are not
+ * advertised.
+ *
+ * @param kSlot Slot number
+ * @param kCrc CRC16 of the stored bytecode
+ */
+void ble_set_slot_crc(const uint8_t kSlot, const uint16_t kCrc) {
+  if ((kSlot < 1) || (kSlot > BLE_ADV_SLOT_COUNT)) {
+    return;
+  }
+  ble_adv_manufacturer.slot_crc[kSlot - 1] = sys_cpu_to_le16(kCrc);
+  k_work_submit(&ble_adv_update_work);
+}
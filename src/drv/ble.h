@@ -14,10 +14,35 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <zephyr/bluetooth/conn.h>
 #include <zephyr/types.h>
 
 #include "ble_blink.h"
 
+/**
+ * @brief Maximum number of simultaneous connections
+ */
+#define BLE_MAX_CONN (CONFIG_BT_MAX_CONN)
+
+/**
+ * @brief Company identifier of the advertised manufacturer data
+ * @details The default 0xFFFF is reserved by the Bluetooth SIG for tests and
+ * internal use; products set their assigned identifier in
+ * CONFIG_OPENBLINK_COMPANY_ID
+ */
+#define BLE_COMPANY_ID (CONFIG_OPENBLINK_COMPANY_ID)
+
+/**
+ * @brief Number of bytecode slots reported in the status
+ */
+#define BLE_STATUS_SLOT_COUNT (CONFIG_OPENBLINK_SLOT_COUNT)
+
+/**
+ * @brief Number of bytecode slots whose CRC16 is advertised
+ * @details Fixed, so the scan response keeps its layout and fits 31 bytes
+ */
+#define BLE_ADV_SLOT_COUNT (2)
+
 /**
  * @brief BLE event types for callback notifications
  */
@@ -31,6 +56,17 @@ enum {
   BLE_EVENT_STATUS,       /**< Status information requested */
   BLE_EVENT_REBOOT,       /**< Reboot request received */
   BLE_EVENT_RELOAD,       /**< Reload request received */
+  BLE_EVENT_PROFILE,      /**< Profiler command received */
+  BLE_EVENT_SLOT_READ,    /**< Part of the stored bytecode requested */
+};
+
+/**
+ * @brief Profiler actions of BLE_EVENT_PROFILE
+ */
+enum {
+  BLE_PROFILE_STOP,  /**< Stop sampling and keep the histogram */
+  BLE_PROFILE_START, /**< Clear the histogram and start sampling */
+  BLE_PROFILE_READ,  /**< Read a page of the histogram */
 };
 
 /**
@@ -44,9 +80,11 @@ typedef struct {
     struct {
     } initialized; /**< Initialization event data (empty) */
     struct {
-    } connected; /**< Connection event data (empty) */
+      uint8_t count; /**< Number of connections including this one */
+    } connected;
     struct {
       uint8_t reason; /**< Reason for disconnection */
+      uint8_t count;  /**< Number of connections that remain */
     } disconnected;
     struct {
       uint8_t *data; /**< Pointer to received data */
@@ -60,12 +98,43 @@ typedef struct {
       size_t length;           /**< Length of bytecode */
     } blink;
     struct {
-      uint16_t mtu; /**< Maximum Transmission Unit */
+      uint16_t mtu;          /**< Maximum Transmission Unit */
+      uint8_t vm_state;      /**< Run state of the VM */
+      uint16_t vm_restarts;  /**< Number of VM restarts since boot */
+      uint32_t heap_used;    /**< Used VM heap bytes */
+      uint32_t heap_free;    /**< Free VM heap bytes */
+      uint32_t heap_peak;    /**< Highest used VM heap bytes */
+      uint32_t stack_peak;   /**< Highest used VM stack bytes */
+      uint32_t stack_size;   /**< VM stack size in bytes */
+      uint32_t storage_free; /**< Free storage bytes */
+      uint32_t uptime;       /**< Uptime in seconds */
+      uint32_t reset_cause;  /**< Reset cause flags from hwinfo */
+      /** Length of the bytecode loaded into each slot */
+      uint16_t slot_length[BLE_STATUS_SLOT_COUNT];
+      /** CRC16 of the bytecode loaded into each slot */
+      uint16_t slot_crc[BLE_STATUS_SLOT_COUNT];
     } status;
     struct {
     } reboot; /**< Reboot event data (empty) */
     struct {
-    } reload; /**< Reload event data (empty) */
+      uint8_t slot; /**< Slot to reload, 0 to restart the whole VM */
+    } reload;
+    struct {
+      uint8_t action;   /**< Profiler action */
+      uint8_t interval; /**< Sampling interval in milliseconds for start */
+      uint16_t first;   /**< Index of the first entry for read */
+      uint8_t *buffer;  /**< Buffer to store the page for read */
+      size_t size;      /**< Size of the buffer */
+      size_t length;    /**< Length of the page that was read */
+    } profile;
+    struct {
+      uint8_t slot;    /**< Slot to read */
+      uint16_t offset; /**< Offset in the stored bytecode */
+      uint8_t *buffer; /**< Buffer for the bytecode, NULL for length and CRC */
+      size_t size;     /**< Size of the buffer */
+      ssize_t length;  /**< Bytes read, or length of the stored bytecode */
+      uint16_t crc;    /**< CRC16 of the stored bytecode */
+    } slot_read;
   };
 } BLE_PARAM;
 #pragma pack()
@@ -82,7 +151,11 @@ typedef int (*BLE_CALLBACK)(BLE_PARAM *param);
  * @details Stores connection and callback information
  */
 typedef struct {
-  struct bt_conn *conn;  /**< Bluetooth connection handle */
+  /**
+   * Connection handles indexed by bt_conn_index(), NULL if unused. Each holds
+   * a reference; code outside the connection callbacks uses ble_get_conn().
+   */
+  struct bt_conn *conn[BLE_MAX_CONN];
   BLE_CALLBACK event_cb; /**< Event callback function */
 } BLE_CONTEXT;
 
@@ -95,7 +168,7 @@ typedef struct {
 int ble_init(BLE_CALLBACK cb);
 
 /**
- * @brief Disconnects the current BLE connection
+ * @brief Disconnects all BLE connections
  *
  * @return int 0 on success, negative on error
  */
@@ -117,10 +190,29 @@ int ble_start_advertising(const char *local_name);
 int ble_stop_advertising();
 
 /**
- * @brief Gets the current Maximum Transmission Unit (MTU)
+ * @brief Gets a reference to a connection
+ *
+ * @param kIndex Index of the connection from bt_conn_index()
+ * @return struct bt_conn* Connection to release with bt_conn_unref(), or
+ * NULL if there is none
+ */
+struct bt_conn *ble_get_conn(const size_t kIndex);
+
+/**
+ * @brief Reports upload traffic to the connection policy
+ *
+ * @param conn Connection that carried the upload
+ */
+void ble_policy_activity(struct bt_conn *conn);
+
+/**
+ * @brief Advertises the CRC16 of the stored bytecode of a slot
+ *
+ * @details Slots past BLE_ADV_SLOT_COUNT are not advertised
  *
- * @return uint16_t Current MTU size in bytes
+ * @param kSlot Slot number
+ * @param kCrc CRC16 of the stored bytecode
  */
-uint16_t ble_get_mtu();
+void ble_set_slot_crc(const uint8_t kSlot, const uint16_t kCrc);
 
 #endif  // DRV_BLE_H
@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <soc.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
 #include <zephyr/bluetooth/addr.h>
@@ -24,10 +25,14 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/sys/crc.h>
+#include <zephyr/sys/ring_buffer.h>
 #include <zephyr/sys/util.h>
 #include <zephyr/types.h>
 
 #include "../app/blink.h"
+#include "../app/profiler.h"
+#include "../app/staging.h"
+#include "../lib/lz4/lz4_decoder.h"
 #include "ble.h"
 
 LOG_MODULE_REGISTER(ble_blink, LOG_LEVEL_DBG);
@@ -56,8 +61,32 @@ LOG_MODULE_REGISTER(ble_blink, LOG_LEVEL_DBG);
 #define BT_UUID_OPEN_BLINK_STATUS_CHARACTERISTIC_UUID \
   BT_UUID_DECLARE_128(OPEN_BLINK_STATUS_CHARACTERISTIC_UUID)
 
+/** @brief Benchmark characteristic UUID for link throughput tests */
+#define OPEN_BLINK_BENCH_CHARACTERISTIC_UUID \
+  BT_UUID_128_ENCODE(0xe4055040, 0xc0f8, 0x4c51, 0xa226, 0x825c49119788)
+/** @brief Benchmark characteristic UUID declaration */
+#define BT_UUID_OPEN_BLINK_BENCH_CHARACTERISTIC_UUID \
+  BT_UUID_DECLARE_128(OPEN_BLINK_BENCH_CHARACTERISTIC_UUID)
+
+/** @brief Slot characteristic UUID for reading back stored bytecode */
+#define OPEN_BLINK_SLOT_CHARACTERISTIC_UUID \
+  BT_UUID_128_ENCODE(0x5b1e7c2d, 0x94a3, 0x4f06, 0x8d2b, 0x3e61c0a9f874)
+/** @brief Slot characteristic UUID declaration */
+#define BT_UUID_OPEN_BLINK_SLOT_CHARACTERISTIC_UUID \
+  BT_UUID_DECLARE_128(OPEN_BLINK_SLOT_CHARACTERISTIC_UUID)
+
 /** @brief Blink protocol version */
 #define BLINK_VERSION 0x01
+/** @brief Blink protocol version 2 (LZ4 compressed 'D'ata chunks) */
+#define BLINK_VERSION_2 0x02
+
+/** @brief Program flag: the 'D'ata chunks carried an LZ4 block */
+#define BLINK_PROGRAM_FLAG_COMPRESSED 0x01
+
+/** @brief Missing ranges flag: chunks past the first gap are dropped */
+#define BLINK_RANGES_FLAG_IN_ORDER 0x01
+/** @brief Missing ranges flag: the data failed the CRC check */
+#define BLINK_RANGES_FLAG_SUSPECT 0x02
 
 /** @brief Command code for data chunk transfer */
 #define BLINK_CMD_DATA 'D'  // Data
@@ -67,15 +96,68 @@ LOG_MODULE_REGISTER(ble_blink, LOG_LEVEL_DBG);
 #define BLINK_CMD_RESET 'R'  // softReset
 /** @brief Command code for bytecode reload */
 #define BLINK_CMD_RELOAD 'L'  // reLoad
+/** @brief Command code for copying ranges of the stored bytecode */
+#define BLINK_CMD_PATCH 'X'  // patch (delta against stored slot)
+/** @brief Command code for controlling the throughput benchmark */
+#define BLINK_CMD_BENCH 'B'  // Benchmark
+/** @brief Command code for querying the missing ranges of an upload */
+#define BLINK_CMD_QUERY 'Q'  // Query missing ranges
+/** @brief Command code for several commands in one write (version 2) */
+#define BLINK_CMD_BATCH 'G'  // Group of commands
+/** @brief Command code for starting or resuming an identified upload */
+#define BLINK_CMD_UPLOAD 'U'  // Upload session
+/** @brief Command identifier for profiler control */
+#define BLINK_CMD_PROFILE 'S'  // Sampling profiler
+/** @brief Notification code for the missing ranges report */
+#define BLINK_NOTIFY_MISSING 'M'  // Missing ranges
+
+/** @brief Notification code for returned credits */
+#define BLINK_NOTIFY_CREDIT 'C'  // Credits
+
+/** @brief Notification code for a profiler page */
+#define BLINK_NOTIFY_PROFILE 'S'  // Sampling profiler page
+
+/** @brief Benchmark mode: stopped */
+#define BLINK_BENCH_MODE_STOP 0x00
+/** @brief Benchmark mode: count bytes written to the characteristic */
+#define BLINK_BENCH_MODE_SINK 0x01
+/** @brief Benchmark mode: stream notifications from the characteristic */
+#define BLINK_BENCH_MODE_SOURCE 0x02
+
+/** @brief Size of the console output buffer in bytes */
+#define BLINK_CONSOLE_BUFFER_SIZE (1024)
+/** @brief Delay before buffered console output is sent in milliseconds */
+#define BLINK_CONSOLE_FLUSH_MS (10)
+/** @brief Time ble_write() waits for buffer space in milliseconds */
+#define BLINK_CONSOLE_WRITE_TIMEOUT_MS (1000)
+/** @brief Largest console notification payload (ATT header is 3 bytes) */
+#define BLINK_CONSOLE_PACKET_SIZE (CONFIG_BT_L2CAP_TX_MTU - 3)
+
+/** @brief Maximum number of ranges in a missing ranges report */
+#define BLINK_MAX_MISSING_RANGES (STAGING_MAX_RANGES + 1)
+
+/** @brief Bytes of the patch base read from the slot at a time */
+#define BLINK_PATCH_READ_SIZE (64)
+
+/**
+ * @brief Number of 'D'ata and 'X' writes the host may have outstanding
+ * @details Granted in full when the status characteristic is read and after
+ * each 'P'rogram command
+ */
+#define BLINK_CREDIT_WINDOW (8)
+/** @brief Number of processed writes returned with one credit notification */
+#define BLINK_CREDIT_BATCH (BLINK_CREDIT_WINDOW / 2)
 
 /**
  * @brief Header structure for all Blink protocol chunks
  */
 #pragma pack(1)
 typedef struct {
-  uint8_t version;    /**< Blink protocol version (0x01) */
+  uint8_t version;    /**< Blink protocol version (0x01 or 0x02) */
   uint8_t command;    /**< Command type: 'D':Data, 'P':Program, 'R':Reset,
-                         'L':Reload */
+                         'L':Reload, 'X':Patch, 'Q':Query,
+                         'B':Benchmark, 'G':Batch, 'U':Upload,
+                         'S':Sampling profiler */
 } BLINK_CHUNK_HEADER; /**< 2 bytes total */
 #pragma pack()
 
@@ -99,17 +181,391 @@ typedef struct {
   uint16_t length;           /**< Total bytecode length */
   uint16_t crc;              /**< CRC16 checksum */
   uint8_t slot;              /**< Target slot for bytecode */
-  uint8_t reserved;          /**< Reserved for future use */
+  uint8_t flags;             /**< Flags (version 2), reserved in version 1 */
 } BLINK_CHUNK_PROGRAM;       /**< 8 bytes total */
 #pragma pack()
 
+/**
+ * @brief Structure for patch command
+ * @details Followed by an array of BLINK_PATCH_COPY entries. The base is
+ * identified by the length and CRC16 of the bytecode currently stored in the
+ * slot, so a patch is never applied to a different program.
+ */
+#pragma pack(1)
+typedef struct {
+  BLINK_CHUNK_HEADER header; /**< Common header */
+  uint16_t base_length;      /**< Length of the stored bytecode */
+  uint16_t base_crc;         /**< CRC16 of the stored bytecode */
+  uint8_t slot;              /**< Slot holding the base bytecode */
+  uint8_t reserved;          /**< Reserved for future use */
+} BLINK_CHUNK_PATCH;         /**< 8 bytes total + copy entries */
+#pragma pack()
+
+/**
+ * @brief Copy entry of a patch command
+ * @details Copies size bytes from the base bytecode at src to the bytecode
+ * buffer at dst. Bytes not covered by copies are sent with 'D'ata chunks.
+ */
+#pragma pack(1)
+typedef struct {
+  uint16_t dst;     /**< Offset in bytecode buffer */
+  uint16_t src;     /**< Offset in base bytecode */
+  uint16_t size;    /**< Number of bytes to copy */
+} BLINK_PATCH_COPY; /**< 6 bytes total */
+#pragma pack()
+
+/**
+ * @brief Structure for the missing ranges query
+ */
+#pragma pack(1)
+typedef struct {
+  BLINK_CHUNK_HEADER header; /**< Common header */
+  uint16_t length;           /**< Total bytecode length */
+} BLINK_CHUNK_QUERY;         /**< 4 bytes total */
+#pragma pack()
+
+/**
+ * @brief Structure for reloading a single slot
+ * @details A reload command of only the header restarts the whole VM
+ */
+#pragma pack(1)
+typedef struct {
+  BLINK_CHUNK_HEADER header; /**< Common header */
+  uint8_t slot;              /**< Slot to reload */
+} BLINK_CHUNK_RELOAD;        /**< 3 bytes total */
+#pragma pack()
+
+/**
+ * @brief Structure for the upload session command
+ * @details Identifies an upload so it can be resumed after the connection
+ * drops. The host picks the id; length and crc describe the complete bytecode.
+ */
+#pragma pack(1)
+typedef struct {
+  BLINK_CHUNK_HEADER header; /**< Common header */
+  uint16_t id;               /**< Upload identifier chosen by the host */
+  uint16_t length;           /**< Total bytecode length */
+  uint16_t crc;              /**< CRC16 of the complete bytecode */
+} BLINK_CHUNK_UPLOAD;        /**< 8 bytes total */
+#pragma pack()
+
+/**
+ * @brief Sub-command entry of a batch command
+ * @details A batch command is a version 2 header followed by entries, each a
+ * length and a complete command of that length. Batches cannot be nested.
+ */
+#pragma pack(1)
+typedef struct {
+  uint16_t length;   /**< Length of the following command */
+} BLINK_BATCH_ENTRY; /**< 2 bytes total + command */
+#pragma pack()
+
+/**
+ * @brief Missing ranges report sent as a program notification
+ * @details Followed by count BLINK_RANGE entries in ascending order. The
+ * header command is 'M' so it can be told apart from text notifications.
+ */
+#pragma pack(1)
+typedef struct {
+  BLINK_CHUNK_HEADER header; /**< Common header */
+  uint16_t staged;           /**< Contiguous bytes received from offset 0 */
+  uint8_t count;             /**< Number of range entries */
+  uint8_t flags;             /**< BLINK_RANGES_FLAG_* */
+} BLINK_NOTIFY_RANGES;       /**< 6 bytes total + range entries */
+#pragma pack()
+
+/**
+ * @brief Range entry of a missing ranges report
+ */
+#pragma pack(1)
+typedef struct {
+  uint16_t offset; /**< Offset in bytecode buffer */
+  uint16_t size;   /**< Number of bytes missing */
+} BLINK_RANGE;     /**< 4 bytes total */
+#pragma pack()
+
+/**
+ * @brief Credit notification sent through the program characteristic
+ */
+#pragma pack(1)
+typedef struct {
+  BLINK_CHUNK_HEADER header; /**< Common header (command 'C') */
+  uint8_t credits;           /**< Number of credits returned */
+  uint8_t reserved;          /**< Reserved for future use */
+} BLINK_NOTIFY_CREDITS;      /**< 4 bytes total */
+#pragma pack()
+
+/**
+ * @brief Profiler page sent as a program notification
+ * @details Followed by a profiler_page_t and its entries. The header command
+ * is 'S' so it can be told apart from text notifications.
+ */
+#pragma pack(1)
+typedef struct {
+  BLINK_CHUNK_HEADER header; /**< Common header (command 'S') */
+} BLINK_NOTIFY_PROFILE_PAGE; /**< 2 bytes total + page */
+#pragma pack()
+
+/**
+ * @brief Structure for benchmark control command
+ */
+#pragma pack(1)
+typedef struct {
+  BLINK_CHUNK_HEADER header; /**< Common header */
+  uint8_t mode;              /**< Benchmark mode */
+  uint8_t reserved;          /**< Reserved for future use */
+  uint32_t length;           /**< Bytes to send in source mode */
+} BLINK_CHUNK_BENCH;         /**< 8 bytes total */
+#pragma pack()
+
+/**
+ * @brief Structure for profiler control command
+ * @details A read returns one page of the histogram as a program
+ * notification, starting with the entry at index first
+ */
+#pragma pack(1)
+typedef struct {
+  BLINK_CHUNK_HEADER header; /**< Common header */
+  uint8_t mode;              /**< 0x00:Stop, 0x01:Start, 0x02:Read */
+  uint8_t interval;          /**< Sampling interval in milliseconds */
+  uint16_t first;            /**< Index of the first entry to read */
+} BLINK_CHUNK_PROFILE;       /**< 6 bytes total */
+#pragma pack()
+
+/**
+ * @brief Layout version of the status characteristic
+ */
+#define BLINK_STATUS_VERSION (2)
+
+/**
+ * @brief Number of slot entries in the fixed part of the status
+ */
+#define BLINK_STATUS_SLOTS (2)
+
+/**
+ * @brief Number of slot entries appended after the fixed part of the status
+ */
+#define BLINK_STATUS_MORE_SLOTS \
+  (MAX(BLE_STATUS_SLOT_COUNT, BLINK_STATUS_SLOTS) - BLINK_STATUS_SLOTS)
+
+/**
+ * @brief Bytecode slot entry of the status characteristic
+ */
+#pragma pack(1)
+typedef struct {
+  uint16_t length;   /**< Length of the loaded bytecode, 0 if none */
+  uint16_t crc;      /**< CRC16 of the loaded bytecode */
+} BLINK_STATUS_SLOT; /**< 4 bytes total */
+#pragma pack()
+
+/**
+ * @brief Value of the status characteristic
+ *
+ * @details Fields are only ever appended; hosts check the version and the
+ * read length before using fields added after the first 24 bytes.
+ */
+#pragma pack(1)
+typedef struct {
+  uint16_t mtu;              /**< Maximum Transmission Unit */
+  uint8_t credits;           /**< Credit window for 'D'ata and 'X' writes */
+  uint8_t bench_mode;        /**< Current benchmark mode */
+  uint32_t throughput;       /**< Bytes per second of the last upload */
+  uint16_t interval;         /**< Connection interval in 1.25 ms units */
+  uint8_t tx_phy;            /**< TX PHY (1:1M, 2:2M, 4:Coded) */
+  uint8_t rx_phy;            /**< RX PHY (1:1M, 2:2M, 4:Coded) */
+  uint16_t tx_data_len;      /**< Maximum TX payload per link layer packet */
+  uint16_t rx_data_len;      /**< Maximum RX payload per link layer packet */
+  uint32_t bench_bytes;      /**< Bytes counted by the benchmark */
+  uint32_t bench_throughput; /**< Bytes per second of the benchmark */
+  uint8_t version;           /**< Layout version of this structure */
+  uint8_t vm_state;          /**< VM state (0:Loading, 1:Running, 2:Stopped) */
+  uint16_t vm_restarts;      /**< Number of VM restarts since boot */
+  uint32_t heap_used;        /**< Used VM heap bytes */
+  uint32_t heap_free;        /**< Free VM heap bytes */
+  uint32_t heap_peak;        /**< Highest used VM heap bytes since boot */
+  uint32_t stack_peak;       /**< Highest used VM stack bytes */
+  uint32_t stack_size;       /**< VM stack size in bytes */
+  uint32_t storage_free;     /**< Free storage bytes */
+  uint32_t uptime;           /**< Uptime in seconds */
+  uint32_t reset_cause;      /**< Reset cause flags from hwinfo */
+  /** Length and CRC16 of the bytecode loaded into slots 1 and 2 */
+  BLINK_STATUS_SLOT slots[BLINK_STATUS_SLOTS];
+  uint32_t first_write;      /**< Milliseconds to the first command */
+  uint8_t slot_count;        /**< Number of slots of the device */
+} BLINK_STATUS;              /**< 73 bytes total */
+#pragma pack()
+
+/**
+ * @brief Status value with the entries of the slots past slot 2
+ * @details Only the entries of existing slots are sent
+ */
+#pragma pack(1)
+typedef struct {
+  BLINK_STATUS status; /**< Fixed part */
+  /** Length and CRC16 of the bytecode loaded into slot 3 and on */
+  BLINK_STATUS_SLOT more[MAX(BLINK_STATUS_MORE_SLOTS, 1)];
+} BLINK_STATUS_VALUE;
+#pragma pack()
+
+/**
+ * @brief Header of the slot characteristic value
+ * @details Followed by a page of the stored bytecode of the selected slot,
+ * starting at offset
+ */
+#pragma pack(1)
+typedef struct {
+  uint8_t slot;      /**< Selected slot */
+  uint8_t reserved;  /**< Reserved, 0 */
+  uint16_t length;   /**< Length of the stored bytecode, 0 if empty */
+  uint16_t crc;      /**< CRC16 of the stored bytecode */
+  uint16_t offset;   /**< Offset of the page in the stored bytecode */
+} BLINK_SLOT_HEADER; /**< 8 bytes total */
+#pragma pack()
+
+/**
+ * @brief Selection written to the slot characteristic
+ * @details A write of the slot alone selects offset 0
+ */
+#pragma pack(1)
+typedef struct {
+  uint8_t slot;      /**< Slot to read back */
+  uint16_t offset;   /**< Offset of the page to read back */
+} BLINK_SLOT_SELECT; /**< 3 bytes total */
+#pragma pack()
+
+/**
+ * @brief Largest slot characteristic value
+ * @details The maximum length of an attribute value; centrals stop a long
+ * read there
+ */
+#define BLINK_SLOT_VALUE_SIZE (512)
+
+/**
+ * @brief Number of bytecode bytes in a page of the slot characteristic
+ */
+#define BLINK_SLOT_PAGE_SIZE (BLINK_SLOT_VALUE_SIZE - sizeof(BLINK_SLOT_HEADER))
+
 // -------------------------------------------------------------------------------------------
 
 /** @brief External reference to BLE context */
 extern BLE_CONTEXT ble_context;
 
-/** @brief Buffer for storing received bytecode */
-static uint8_t blink_bytecode[BLINK_MAX_BYTECODE_SIZE] = {0};
+/**
+ * @brief Identity of an upload started with the 'U'pload command
+ */
+typedef struct {
+  bool active;     /**< true if the upload is identified */
+  uint16_t id;     /**< Upload identifier chosen by the host */
+  uint16_t length; /**< Total bytecode length */
+  uint16_t crc;    /**< CRC16 of the complete bytecode */
+} blink_upload_t;
+
+/**
+ * @brief Upload session of a connection
+ */
+typedef struct {
+  struct bt_conn *conn;  /**< Connection, NULL if the session is unused */
+  uint8_t staging;       /**< Staging session holding the upload */
+  blink_upload_t upload; /**< Identity of a resumable upload */
+  /** Length and CRC16 of the last 'P'rogram that found data missing */
+  blink_upload_t expected;
+  /** Status snapshot served by a long read of the status characteristic */
+  BLINK_STATUS_VALUE status;
+  /** Page read through the slot characteristic */
+  struct {
+    uint8_t slot;    /**< Selected slot */
+    uint16_t offset; /**< Offset of the selected page */
+    uint16_t length; /**< Length of the bytecode when the read started */
+    uint16_t crc;    /**< CRC16 of the bytecode when the read started */
+  } readback;
+  uint32_t connected;    /**< Uptime of the connection in milliseconds */
+  uint32_t first_write;  /**< Milliseconds to the first command, 0 if none */
+  lz4_decoder_t decoder; /**< Decoder for compressed 'D'ata chunks */
+  /** Compressed transfer state */
+  struct {
+    bool active;          /**< true if decoder holds a transfer */
+    uint16_t next_offset; /**< Expected offset of the next compressed chunk */
+  } compressed;
+  /** Flow control and throughput state of the upload */
+  struct {
+    bool active;         /**< true while an upload is being measured */
+    uint8_t consumed;    /**< Writes processed since the last credit return */
+    uint32_t start;      /**< Uptime of the first write in milliseconds */
+    uint32_t bytes;      /**< Bytes written by the host during the upload */
+    uint32_t throughput; /**< Bytes per second of the last upload */
+  } flow;
+} blink_session_t;
+
+/** @brief Index of the session that collects the broadcast upload */
+#define BLINK_BROADCAST_SESSION (BLE_MAX_CONN)
+
+/** @brief Staging session that is not owned by an upload session at boot */
+#define BLINK_SPARE_STAGING (BLINK_BROADCAST_SESSION + 1)
+
+BUILD_ASSERT(BLINK_SPARE_STAGING < STAGING_SESSION_COUNT,
+             "Each connection, the broadcast and a parked upload need a "
+             "staging session");
+
+/**
+ * @brief Upload sessions indexed by bt_conn_index()
+ * @details The last session collects the broadcast upload and has no
+ * connection.
+ */
+static blink_session_t blink_sessions[BLINK_BROADCAST_SESSION + 1];
+
+/**
+ * @brief Upload parked when its connection ended
+ * @details Session and parked upload swap staging sessions, so the staged
+ * data stays in place when an upload is parked or resumed.
+ */
+static struct {
+  blink_upload_t upload; /**< Identity of the parked upload */
+  uint8_t staging;       /**< Staging session holding it, or spare */
+} blink_parked = {.staging = BLINK_SPARE_STAGING};
+
+/**
+ * @brief Session of the command being processed
+ * @details Commands are processed one at a time in the BT RX thread
+ */
+static blink_session_t *blink_session = &blink_sessions[0];
+
+/** @brief Broadcast upload state */
+static struct {
+  bool done;       /**< true once the announced program is committed */
+  uint8_t slot;    /**< Slot of the committed program */
+  uint16_t length; /**< Length of the committed program */
+  uint16_t crc;    /**< CRC16 of the committed program */
+} blink_broadcast;
+
+/** @brief Console output waiting to be notified */
+RING_BUF_DECLARE(blink_console_ring, BLINK_CONSOLE_BUFFER_SIZE);
+
+/** @brief Console output state */
+static struct {
+  struct k_spinlock lock; /**< Protects blink_console_ring */
+  uint32_t dropped;       /**< Bytes dropped because the buffer was full */
+  uint16_t payload;       /**< Notification payload size of the last flush */
+  uint16_t head;          /**< Size of the packet being sent, 0 if none */
+  uint32_t sent;          /**< Connections that already got the packet */
+} blink_console = {.payload = BT_ATT_DEFAULT_LE_MTU - 3};
+
+/** @brief Signaled when console buffer space has been freed */
+static K_SEM_DEFINE(blink_console_space, 0, 1);
+
+/** @brief Profiler page notification being sent */
+static uint8_t
+    blink_profile_page[sizeof(BLINK_NOTIFY_PROFILE_PAGE) + PROFILER_PAGE_SIZE];
+
+/** @brief Throughput benchmark state */
+static struct {
+  struct bt_conn *conn; /**< Connection that started the benchmark */
+  uint8_t index;        /**< bt_conn_index() of that connection */
+  uint8_t mode;         /**< Benchmark mode */
+  uint32_t length;      /**< Bytes to send in source mode */
+  uint32_t bytes;       /**< Bytes received or sent */
+  uint32_t start;       /**< Uptime of the first byte in milliseconds */
+  uint32_t last;        /**< Uptime of the last byte in milliseconds */
+} blink_bench;
 
 /**
  * @brief Sends a notification through the program characteristic
@@ -119,6 +575,34 @@ static uint8_t blink_bytecode[BLINK_MAX_BYTECODE_SIZE] = {0};
  */
 static int notify_blink_program(const char *data);
 
+/**
+ * @brief Starts streaming benchmark notifications
+ */
+static void blink_bench_start_source(void);
+
+/**
+ * @brief Processes a Blink command
+ *
+ * @param session Upload session of the sending connection
+ * @param header Pointer to the command header
+ * @param len Total length of the command
+ * @param kCredits true if Data and Patch commands use flow control credits
+ */
+static void blink_dispatch(blink_session_t *const session,
+                           BLINK_CHUNK_HEADER *header, uint16_t len,
+                           const bool kCredits);
+
+/**
+ * @brief Sends binary data as a notification through the program
+ * characteristic
+ *
+ * @param kData Data to send
+ * @param kSize Size of the data
+ * @return int 0 on success, negative on error
+ */
+static int notify_blink_program_data(const void *const kData,
+                                     const uint16_t kSize);
+
 /**
  * @brief Sends an error message as a notification
  *
@@ -129,6 +613,200 @@ static void blink_result_error(const char *msg) {
   notify_blink_program(msg);
 }
 
+/**
+ * @brief Grants the full credit window again
+ *
+ * @param session Session to reset
+ */
+static void blink_flow_reset(blink_session_t *const session) {
+  session->flow.active = false;
+  session->flow.consumed = 0;
+}
+
+/**
+ * @brief Counts a processed write and returns credits to the host
+ *
+ * @details Writes are processed in the BT RX thread, so a write that stalls
+ * on flash also holds back its credit. Transports with their own flow control
+ * only count the bytes.
+ *
+ * @param kVersion Protocol version of the write
+ * @param kLength Length of the write
+ * @param kCredits true if the write used a credit
+ */
+static void blink_flow_consume(const uint8_t kVersion, const uint16_t kLength,
+                               const bool kCredits) {
+  if (!blink_session->flow.active) {
+    blink_session->flow.active = true;
+    blink_session->flow.start = k_uptime_get_32();
+    blink_session->flow.bytes = 0;
+  }
+  blink_session->flow.bytes += kLength;
+  ble_policy_activity(blink_session->conn);
+
+  if (!kCredits || (++blink_session->flow.consumed < BLINK_CREDIT_BATCH)) {
+    return;
+  }
+  BLINK_NOTIFY_CREDITS credit = {
+      .header.version = kVersion,
+      .header.command = BLINK_NOTIFY_CREDIT,
+      .credits = blink_session->flow.consumed,
+  };
+  blink_session->flow.consumed = 0;
+  notify_blink_program_data(&credit, sizeof(credit));
+}
+
+/**
+ * @brief Completes the throughput measurement of the upload
+ */
+static void blink_flow_finish(void) {
+  if (blink_session->flow.active) {
+    const uint32_t kElapsed =
+        MAX(k_uptime_get_32() - blink_session->flow.start, 1U);
+    blink_session->flow.throughput =
+        (uint32_t)(((uint64_t)blink_session->flow.bytes * 1000U) / kElapsed);
+    LOG_INF("BLE: Blink upload %u bytes in %u ms (%u bytes/s) session:%d",
+            blink_session->flow.bytes, kElapsed,
+            blink_session->flow.throughput, blink_session->staging);
+  }
+  blink_flow_reset(blink_session);
+}
+
+/**
+ * @brief Reports the missing ranges of an upload
+ *
+ * @details Ranges that do not fit into one notification are left out; the
+ * host queries again after retransmitting the reported ones.
+ *
+ * @param kVersion Protocol version of the request
+ * @param kLength Total bytecode length expected by the host
+ * @param kSuspect true if all received bytes failed verification
+ */
+static void blink_report_missing(const uint8_t kVersion, const uint16_t kLength,
+                                 const bool kSuspect) {
+  staging_range_t missing[BLINK_MAX_MISSING_RANGES];
+  size_t count = 0;
+  if (kSuspect) {
+    missing[0].offset = 0;
+    missing[0].size = kLength;
+    count = (0 < kLength) ? 1 : 0;
+  } else {
+    count = staging_get_missing(blink_session->staging, kLength, missing,
+                                ARRAY_SIZE(missing));
+  }
+
+  // Fit the report into one notification (ATT header is 3 bytes)
+  const size_t kMtu = bt_gatt_get_mtu(blink_session->conn);
+  const size_t kFit =
+      (kMtu > 3 + sizeof(BLINK_NOTIFY_RANGES))
+          ? (kMtu - 3 - sizeof(BLINK_NOTIFY_RANGES)) / sizeof(BLINK_RANGE)
+          : 0;
+  count = MIN(count, kFit);
+
+  uint8_t buf[sizeof(BLINK_NOTIFY_RANGES) +
+              BLINK_MAX_MISSING_RANGES * sizeof(BLINK_RANGE)];
+  BLINK_NOTIFY_RANGES *report = (BLINK_NOTIFY_RANGES *)buf;
+  BLINK_RANGE *range = (BLINK_RANGE *)(report + 1);
+  report->header.version = kVersion;
+  report->header.command = BLINK_NOTIFY_MISSING;
+  report->staged =
+      kSuspect ? 0 : MIN(staging_get_length(blink_session->staging), kLength);
+  report->count = count;
+  report->flags = (staging_keeps_ranges() ? 0 : BLINK_RANGES_FLAG_IN_ORDER) |
+                  (kSuspect ? BLINK_RANGES_FLAG_SUSPECT : 0);
+  for (size_t i = 0; i < count; i++) {
+    range[i].offset = missing[i].offset;
+    range[i].size = missing[i].size;
+  }
+  LOG_DBG("BLE: Blink missing ranges:%d staged:%d", count, report->staged);
+
+  notify_blink_program_data(buf, sizeof(BLINK_NOTIFY_RANGES) +
+                                     count * sizeof(BLINK_RANGE));
+}
+
+/**
+ * @brief Writes bytecode to the staging area
+ *
+ * @details A write at offset 0 does not start a new upload, so a resent chunk
+ * fills in place. Chunks that cannot be kept are dropped and show up in the
+ * missing ranges report.
+ *
+ * @param kOffset Offset in the bytecode
+ * @param kData Pointer to the bytecode data
+ * @param kSize Size of the bytecode data
+ * @return int 0 on success, negative on error
+ */
+static int blink_stage(const size_t kOffset, const void *const kData,
+                       const size_t kSize) {
+  if (kOffset + kSize > BLINK_MAX_BYTECODE_SIZE) {
+    blink_result_error("ERROR: Size exceeds buffer limits");
+    return -EINVAL;
+  }
+
+  int err = staging_write(blink_session->staging, kOffset, kData, kSize);
+  if (-EINVAL == err) {
+    LOG_WRN("BLE: Blink chunk dropped offset:%d size:%d", kOffset, kSize);
+  } else if (0 != err) {
+    blink_result_error("ERROR: Blink staging error");
+  }
+  return err;
+}
+
+/**
+ * @brief Reads back staged bytecode for the decoder history
+ *
+ * @param kOffset Offset in the bytecode
+ * @param data Buffer to store the bytecode
+ * @param kLength Number of bytes to read
+ * @return int 0 on success, negative on error
+ */
+static int blink_stage_read(const size_t kOffset, void *const data,
+                            const size_t kLength) {
+  return staging_read(blink_session->staging, kOffset, data, kLength);
+}
+
+/**
+ * @brief Decompresses a data chunk into the staging area
+ *
+ * @details Version 2 chunks carry consecutive pieces of one LZ4 block and
+ * their offset refers to the compressed stream. Chunks must arrive in order;
+ * a chunk at offset 0 starts a new transfer, and a new upload unless the
+ * upload was started with the 'U'pload command.
+ *
+ * @param kOffset Offset of the chunk in the compressed stream
+ * @param kData Compressed data
+ * @param kSize Size of the compressed data
+ * @return int 0 on success, negative on error
+ */
+static int blink_decompress_chunk(const uint16_t kOffset,
+                                  const uint8_t *const kData,
+                                  const uint16_t kSize) {
+  if (0 == kOffset) {
+    // The decoder writes the whole image again from its start
+    if (!blink_session->upload.active) {
+      staging_reset(blink_session->staging);
+    }
+    lz4_decoder_init(&blink_session->decoder, blink_stage, blink_stage_read,
+                     BLINK_MAX_BYTECODE_SIZE);
+    blink_session->compressed.active = true;
+    blink_session->compressed.next_offset = 0;
+  }
+
+  if (!blink_session->compressed.active ||
+      (kOffset != blink_session->compressed.next_offset)) {
+    blink_result_error("ERROR: Blink data out of order");
+    return -EINVAL;
+  }
+
+  if (0 != lz4_decoder_feed(&blink_session->decoder, kData, kSize)) {
+    blink_session->compressed.active = false;
+    blink_result_error("ERROR: Blink decompression error");
+    return -EINVAL;
+  }
+  blink_session->compressed.next_offset += kSize;
+  return 0;
+}
+
 /**
  * @brief Processes a data chunk command (BLINK_CMD_DATA)
  *
@@ -153,20 +831,142 @@ static int blink_program_command_D(BLINK_CHUNK_HEADER *header, uint16_t len) {
       "len:%d size:%d offset:%d",
       len, size, offset);
 
-  if (offset + size > BLINK_MAX_BYTECODE_SIZE) {
-    blink_result_error("ERROR: Size exceeds buffer limits");
-    return -1;
+  if (BLINK_VERSION_2 == header->version) {
+    return blink_decompress_chunk(offset, (uint8_t *)(data_chunk + 1), size);
+  }
+
+  if (0 == offset) {
+    blink_session->compressed.active = false;
   }
 
   uint8_t *buffer = (uint8_t *)(data_chunk + 1);
-  memcpy(&blink_bytecode[offset], buffer, size);
-  return 0;
+  return blink_stage(offset, buffer, size);
 }
 
 /**
- * @brief Processes a program execution command (BLINK_CMD_PROG)
+ * @brief Checks the stored bytecode a patch is applied against
  *
- * @param header Pointer to the command header
+ * @details Compares the length and CRC16 of the slot without reading the
+ * bytecode into RAM; the CRC16 is usually known from the last load or store.
+ * An empty slot is a base of 0 bytes.
+ *
+ * @param p Pointer to the patch command
+ * @return int 0 on success, negative on error
+ */
+static int blink_patch_check_base(const BLINK_CHUNK_PATCH *p) {
+  BLE_PARAM param = {
+      .event = BLE_EVENT_SLOT_READ,
+      .slot_read.slot = p->slot,
+  };
+  if (0 != ble_context.event_cb(&param)) {
+    return -EIO;
+  }
+  const ssize_t kLength =
+      (0 < param.slot_read.length) ? param.slot_read.length : 0;
+  if (kLength != p->base_length) {
+    LOG_ERR("BLE: Patch base length %d != %d", kLength, p->base_length);
+    return -ENOENT;
+  }
+  if (param.slot_read.crc != p->base_crc) {
+    LOG_ERR("BLE: Patch base CRC16 0x%04X != 0x%04X", param.slot_read.crc,
+            p->base_crc);
+    return -EBADMSG;
+  }
+  return 0;
+}
+
+/**
+ * @brief Copies a range of the stored bytecode of a slot to the staging area
+ *
+ * @details Reads the range in parts of BLINK_PATCH_READ_SIZE bytes, so no
+ * copy of the base is kept in RAM.
+ *
+ * @param kSlot Slot holding the base
+ * @param kDst Offset in the bytecode buffer
+ * @param kSrc Offset in the base bytecode
+ * @param kSize Number of bytes to copy
+ * @return int 0 on success, negative on error
+ */
+static int blink_patch_copy(const uint8_t kSlot, const uint16_t kDst,
+                            const uint16_t kSrc, const uint16_t kSize) {
+  uint8_t chunk[BLINK_PATCH_READ_SIZE];
+  for (size_t done = 0; done < kSize;) {
+    const size_t kPart = MIN(sizeof(chunk), kSize - done);
+    BLE_PARAM param = {
+        .event = BLE_EVENT_SLOT_READ,
+        .slot_read.slot = kSlot,
+        .slot_read.offset = kSrc + done,
+        .slot_read.buffer = chunk,
+        .slot_read.size = kPart,
+    };
+    if ((0 != ble_context.event_cb(&param)) ||
+        (param.slot_read.length != (ssize_t)kPart)) {
+      blink_result_error("ERROR: Patch base read error");
+      return -EIO;
+    }
+    int err = blink_stage(kDst + done, chunk, kPart);
+    if (0 != err) {
+      return err;
+    }
+    done += kPart;
+  }
+  return 0;
+}
+
+/**
+ * @brief Processes a patch command (BLINK_CMD_PATCH)
+ *
+ * @details Copies ranges of the bytecode stored in the slot into the staging
+ * area, reading them from the slot for each command. Copies and 'D'ata chunks
+ * are sent in ascending offset order to build the new program, which is
+ * committed with the normal 'P'rogram command.
+ *
+ * @param header Pointer to the command header
+ * @param len Total length of the received data
+ * @return int 0 on success, negative on error
+ */
+static int blink_program_command_X(BLINK_CHUNK_HEADER *header, uint16_t len) {
+  BLINK_CHUNK_PATCH *p = (BLINK_CHUNK_PATCH *)header;
+
+  if ((len < sizeof(BLINK_CHUNK_PATCH)) ||
+      (0 != (len - sizeof(BLINK_CHUNK_PATCH)) % sizeof(BLINK_PATCH_COPY))) {
+    blink_result_error("ERROR: Blink data size error");
+    return -EINVAL;
+  }
+
+  LOG_DBG("BLE: Blink patch slot:%d base size:%d CRC16:0x%04X", p->slot,
+          p->base_length, p->base_crc);
+
+  if (!blink_slot_is_valid((blink_slot_t)p->slot)) {
+    blink_result_error("ERROR: Invalid slot");
+    return -EINVAL;
+  }
+
+  if (blink_patch_check_base(p) != 0) {
+    blink_result_error("ERROR: Patch base mismatch");
+    return -EINVAL;
+  }
+
+  const BLINK_PATCH_COPY *copy = (const BLINK_PATCH_COPY *)(p + 1);
+  const size_t count =
+      (len - sizeof(BLINK_CHUNK_PATCH)) / sizeof(BLINK_PATCH_COPY);
+  for (size_t i = 0; i < count; i++) {
+    if (copy[i].src + copy[i].size > p->base_length) {
+      blink_result_error("ERROR: Size exceeds buffer limits");
+      return -EINVAL;
+    }
+    int err = blink_patch_copy(p->slot, copy[i].dst, copy[i].src, copy[i].size);
+    if (0 != err) {
+      return err;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Processes a program execution command (BLINK_CMD_PROG)
+ *
+ * @param header Pointer to the command header
  * @return int 0 on success, negative on error
  */
 static int blink_program_command_P(BLINK_CHUNK_HEADER *header) {
@@ -175,19 +975,59 @@ static int blink_program_command_P(BLINK_CHUNK_HEADER *header) {
   LOG_DBG("BLE: Blink 'P'rogram size:%d slot:%d CRC16:0x%08X", p->length,
           p->slot, p->crc);
 
+  // Every 'P'rogram command grants the full credit window again
+  blink_flow_finish();
+
   if (p->length > BLINK_MAX_BYTECODE_SIZE) {
     blink_result_error("ERROR: Size exceeds buffer limits");
     return -EINVAL;
   }
+  if (!blink_slot_is_valid((blink_slot_t)p->slot)) {
+    // Keep the upload, so it can be committed again to a valid slot
+    blink_result_error("ERROR: Invalid slot");
+    return -EINVAL;
+  }
 
-  // CRC16
-  uint16_t crc16 = crc16_reflect(0xd175U, 0xFFFFU, blink_bytecode, p->length);
+  const uint8_t flags = (BLINK_VERSION_2 == header->version) ? p->flags : 0;
+  if ((flags & BLINK_PROGRAM_FLAG_COMPRESSED) &&
+      (!blink_session->compressed.active ||
+       !lz4_decoder_is_complete(&blink_session->decoder) ||
+       (blink_session->decoder.length != p->length))) {
+    blink_result_error("ERROR: Blink decompression error");
+    blink_session->compressed.active = false;
+    return -EINVAL;
+  }
+
+  // A 'P'rogram for other bytecode than the staged one starts a new upload
+  const blink_upload_t *const kExpected = &blink_session->expected;
+  if (!blink_session->upload.active &&
+      ((staging_get_length(blink_session->staging) > p->length) ||
+       (kExpected->active &&
+        ((kExpected->length != p->length) || (kExpected->crc != p->crc))))) {
+    LOG_INF("BLE: Blink upload restarted for a new program");
+    staging_reset(blink_session->staging);
+  }
+
+  // CRC16 is accumulated while the chunks are staged
+  uint16_t crc16 = 0;
+  int rc = staging_finish(blink_session->staging, p->length, &crc16);
   LOG_DBG("BLE: Blink CRC16: 0x%08X == 0x%08X", crc16, p->crc);
 
-  if (crc16 == p->crc) {
+  if (-ENODATA == rc) {
+    // Keep the upload so that the missing ranges can be retransmitted
+    blink_result_error("ERROR: Blink data incomplete");
+    blink_report_missing(header->version, p->length, false);
+    blink_session->expected.active = true;
+    blink_session->expected.length = p->length;
+    blink_session->expected.crc = p->crc;
+    return 0;
+  } else if (0 != rc) {
+    blink_result_error("ERROR: Blink staging error");
+  } else if (crc16 == p->crc) {
     BLE_PARAM param = {
         .event = BLE_EVENT_BLINK,
-        .blink.blink_bytecode = &blink_bytecode[0],
+        .blink.blink_bytecode =
+            (uint8_t *)staging_get_image(blink_session->staging),
         .blink.slot = p->slot,
         .blink.length = p->length,
     };
@@ -204,91 +1044,623 @@ static int blink_program_command_P(BLINK_CHUNK_HEADER *header) {
 
   } else {
     blink_result_error("ERROR: CRC mismatch");
+    blink_report_missing(header->version, p->length, true);
+  }
+
+  // Discard the upload
+  blink_session->upload.active = false;
+  blink_session->expected.active = false;
+  staging_reset(blink_session->staging);
+  blink_session->compressed.active = false;
+  return 0;
+}
+
+/**
+ * @brief Exchanges the staging sessions of a session and the parked upload
+ *
+ * @param session Upload session
+ */
+static void blink_swap_parked(blink_session_t *const session) {
+  const uint8_t kStaging = session->staging;
+  session->staging = blink_parked.staging;
+  blink_parked.staging = kStaging;
+}
+
+/**
+ * @brief Checks whether an upload has the given identity
+ *
+ * @param kUpload Upload to check
+ * @param u Upload session command
+ * @return true if the upload is identified by the command
+ */
+static bool blink_upload_matches(const blink_upload_t *const kUpload,
+                                 const BLINK_CHUNK_UPLOAD *u) {
+  return kUpload->active && (kUpload->id == u->id) &&
+         (kUpload->length == u->length) && (kUpload->crc == u->crc);
+}
+
+/**
+ * @brief Processes an upload session command (BLINK_CMD_UPLOAD)
+ *
+ * @details Repeating the command of the current upload keeps it. An upload
+ * parked by a dropped connection with the same id, length and CRC16 is
+ * resumed; anything else starts a new upload. The answer is always a missing
+ * ranges report, so the host continues with the ranges that are missing.
+ *
+ * @param header Pointer to the command header
+ * @return int 0 on success, negative on error
+ */
+static int blink_program_command_U(BLINK_CHUNK_HEADER *header) {
+  BLINK_CHUNK_UPLOAD *u = (BLINK_CHUNK_UPLOAD *)header;
+
+  LOG_DBG("BLE: Blink 'U'pload id:%d length:%d CRC16:0x%04X", u->id,
+          u->length, u->crc);
+
+  if (u->length > BLINK_MAX_BYTECODE_SIZE) {
+    blink_result_error("ERROR: Size exceeds buffer limits");
+    return -EINVAL;
+  }
+
+  if (!blink_upload_matches(&blink_session->upload, u)) {
+    if (blink_upload_matches(&blink_parked.upload, u)) {
+      LOG_INF("BLE: Blink upload %d resumed", u->id);
+      blink_swap_parked(blink_session);
+      blink_parked.upload.active = false;
+      staging_reset(blink_parked.staging);
+    } else {
+      staging_reset(blink_session->staging);
+    }
+    blink_session->upload.active = true;
+    blink_session->upload.id = u->id;
+    blink_session->upload.length = u->length;
+    blink_session->upload.crc = u->crc;
+    blink_session->expected.active = false;
+    blink_session->compressed.active = false;
+  }
+  blink_report_missing(header->version, u->length, false);
+  return 0;
+}
+
+/**
+ * @brief Processes a missing ranges query (BLINK_CMD_QUERY)
+ *
+ * @param header Pointer to the command header
+ * @return int 0 on success, negative on error
+ */
+static int blink_program_command_Q(BLINK_CHUNK_HEADER *header) {
+  BLINK_CHUNK_QUERY *q = (BLINK_CHUNK_QUERY *)header;
+
+  LOG_DBG("BLE: Blink 'Q'uery length:%d", q->length);
+
+  if (q->length > BLINK_MAX_BYTECODE_SIZE) {
+    blink_result_error("ERROR: Size exceeds buffer limits");
+    return -EINVAL;
+  }
+  blink_report_missing(header->version, q->length, false);
+  return 0;
+}
+
+/**
+ * @brief Processes a benchmark control command (BLINK_CMD_BENCH)
+ *
+ * @details Every command resets the counters. In sink mode the bytes written
+ * to the benchmark characteristic are counted; in source mode length bytes
+ * are sent as benchmark notifications.
+ *
+ * @param header Pointer to the command header
+ * @return int 0 on success, negative on error
+ */
+static int blink_program_command_B(BLINK_CHUNK_HEADER *header) {
+  BLINK_CHUNK_BENCH *b = (BLINK_CHUNK_BENCH *)header;
+
+  LOG_DBG("BLE: Blink 'B'enchmark mode:%d length:%d", b->mode, b->length);
+
+  if (BLINK_BENCH_MODE_SOURCE < b->mode) {
+    blink_result_error("ERROR: Blink benchmark mode");
+    return -EINVAL;
+  }
+  blink_bench.conn = blink_session->conn;
+  blink_bench.index = bt_conn_index(blink_session->conn);
+  blink_bench.mode = b->mode;
+  blink_bench.length = b->length;
+  blink_bench.bytes = 0;
+  blink_bench.start = k_uptime_get_32();
+  blink_bench.last = blink_bench.start;
+  if (BLINK_BENCH_MODE_SOURCE == b->mode) {
+    blink_bench_start_source();
+  }
+  return 0;
+}
+
+/**
+ * @brief Processes a profiler control command (BLINK_CMD_PROFILE)
+ *
+ * @details Start clears the histogram. Read returns a page as a program
+ * notification to the connection that sent the command, with as many
+ * entries as fit into one notification, so it never mixes with console
+ * output. The host reads pages until it has every entry, preferably after
+ * stopping the profile.
+ *
+ * @param header Pointer to the command header
+ * @return int 0 on success, negative on error
+ */
+static int blink_program_command_S(BLINK_CHUNK_HEADER *header) {
+  BLINK_CHUNK_PROFILE *p = (BLINK_CHUNK_PROFILE *)header;
+
+  LOG_DBG("BLE: Blink 'S'ampling profiler mode:%d interval:%d first:%d",
+          p->mode, p->interval, p->first);
+
+  if (BLE_PROFILE_READ < p->mode) {
+    blink_result_error("ERROR: Blink profiler mode");
+    return -EINVAL;
+  }
+  // Fit the page into one notification (ATT header is 3 bytes)
+  BLINK_NOTIFY_PROFILE_PAGE *notify =
+      (BLINK_NOTIFY_PROFILE_PAGE *)blink_profile_page;
+  const size_t kMtu = bt_gatt_get_mtu(blink_session->conn);
+  const size_t kFit =
+      (kMtu > 3 + sizeof(*notify)) ? (kMtu - 3 - sizeof(*notify)) : 0;
+  BLE_PARAM param = {
+      .event = BLE_EVENT_PROFILE,
+      .profile.action = p->mode,
+      .profile.interval = p->interval,
+      .profile.first = p->first,
+      .profile.buffer = &blink_profile_page[sizeof(*notify)],
+      .profile.size = MIN(kFit, PROFILER_PAGE_SIZE),
+  };
+  ble_context.event_cb(&param);
+  if (BLE_PROFILE_READ != p->mode) {
+    return 0;
+  }
+  if (0 == param.profile.length) {
+    blink_result_error("ERROR: Blink MTU too small");
+    return -EMSGSIZE;
+  }
+  notify->header.version = header->version;
+  notify->header.command = BLINK_NOTIFY_PROFILE;
+  return notify_blink_program_data(blink_profile_page,
+                                   sizeof(*notify) + param.profile.length);
+}
+
+/**
+ * @brief Processes a batch command (BLINK_CMD_BATCH)
+ *
+ * @details Processes the sub-commands in order, as if each had been written
+ * on its own, so a small upload, its 'P'rogram command and a reload fit into
+ * one write. Sub-commands do not use credits; the batch uses one. Processing
+ * stops at the first malformed entry.
+ *
+ * @param session Upload session of the sending connection
+ * @param header Pointer to the command header
+ * @param len Total length of the received data
+ * @return int 0 on success, negative on error
+ */
+static int blink_program_command_G(blink_session_t *const session,
+                                   BLINK_CHUNK_HEADER *header, uint16_t len) {
+  if (BLINK_VERSION_2 != header->version) {
+    blink_result_error("ERROR: Blink batch error");
+    return -EINVAL;
+  }
+
+  const uint8_t *entry = (const uint8_t *)(header + 1);
+  uint16_t remaining = len - sizeof(BLINK_CHUNK_HEADER);
+  while (0 < remaining) {
+    BLINK_BATCH_ENTRY e;
+    if (sizeof(e) > remaining) {
+      blink_result_error("ERROR: Blink batch error");
+      return -EINVAL;
+    }
+    memcpy(&e, entry, sizeof(e));
+    entry += sizeof(e);
+    remaining -= sizeof(e);
+
+    BLINK_CHUNK_HEADER *sub = (BLINK_CHUNK_HEADER *)entry;
+    if ((sizeof(BLINK_CHUNK_HEADER) > e.length) || (e.length > remaining) ||
+        (BLINK_CMD_BATCH == sub->command)) {
+      blink_result_error("ERROR: Blink batch error");
+      return -EINVAL;
+    }
+    blink_dispatch(session, sub, e.length, false);
+    entry += e.length;
+    remaining -= e.length;
+  }
+  return 0;
+}
+
+/**
+ * @brief Gets the benchmark throughput
+ *
+ * @return uint32_t Bytes per second between the first and the last byte
+ */
+static uint32_t blink_bench_throughput(void) {
+  const uint32_t kElapsed = MAX(blink_bench.last - blink_bench.start, 1U);
+  return (uint32_t)(((uint64_t)blink_bench.bytes * 1000U) / kElapsed);
+}
+
+/**
+ * @brief Gets the upload session of a connection
+ *
+ * @param conn Bluetooth connection handle
+ * @return blink_session_t* Session of the connection, NULL if unknown
+ */
+static blink_session_t *blink_get_session(struct bt_conn *conn) {
+  if (NULL == conn) {
+    return NULL;
+  }
+  blink_session_t *session = &blink_sessions[bt_conn_index(conn)];
+  return (conn == session->conn) ? session : NULL;
+}
+
+/**
+ * @brief Processes a Blink command
+ *
+ * @details Results are notified to the connection that sent the command.
+ *
+ * @param session Upload session of the sending connection
+ * @param header Pointer to the command header
+ * @param len Total length of the command
+ * @param kCredits true if Data and Patch commands use flow control credits
+ */
+static void blink_dispatch(blink_session_t *const session,
+                           BLINK_CHUNK_HEADER *header, uint16_t len,
+                           const bool kCredits) {
+  if (NULL == session) {
+    return;
+  }
+  if (0 == session->first_write) {
+    // Time to first write; shows what bonding and GATT caching save
+    session->first_write = MAX(1U, k_uptime_get_32() - session->connected);
+    LOG_INF("BLE: first write %u ms after connection (security L%d)",
+            session->first_write, bt_conn_get_security(session->conn));
+  }
+  blink_session = session;
+  if (sizeof(BLINK_CHUNK_HEADER) > len) {
+    blink_result_error("ERROR: Blink size mismatch");
+    return;
+  }
+  LOG_DBG("BLE: Blink Command [%c]", header->command);
+
+  // Check the version
+  if ((header->version != BLINK_VERSION) &&
+      (header->version != BLINK_VERSION_2)) {
+    blink_result_error("ERROR: Blink version mismatch");
+  }
+
+  switch (header->command) {
+    case BLINK_CMD_DATA:
+      blink_program_command_D(header, len);
+      blink_flow_consume(header->version, len, kCredits);
+      break;
+    case BLINK_CMD_PROG:
+      if (sizeof(BLINK_CHUNK_PROGRAM) != len) {
+        blink_result_error("ERROR: Blink size mismatch");
+      } else {
+        blink_program_command_P(header);
+      }
+      break;
+    case BLINK_CMD_RESET:
+      BLE_PARAM param_reset = {
+          .event = BLE_EVENT_REBOOT,
+      };
+      ble_context.event_cb(&param_reset);
+      break;
+    case BLINK_CMD_RELOAD:
+      BLE_PARAM param_reload = {
+          .event = BLE_EVENT_RELOAD,
+          .reload.slot = (sizeof(BLINK_CHUNK_RELOAD) <= len)
+                             ? ((BLINK_CHUNK_RELOAD *)header)->slot
+                             : 0,
+      };
+      if ((0 != param_reload.reload.slot) &&
+          !blink_slot_is_valid((blink_slot_t)param_reload.reload.slot)) {
+        blink_result_error("ERROR: Invalid slot");
+      } else {
+        ble_context.event_cb(&param_reload);
+      }
+      break;
+    case BLINK_CMD_PATCH:
+      blink_program_command_X(header, len);
+      blink_flow_consume(header->version, len, kCredits);
+      break;
+    case BLINK_CMD_BENCH:
+      if (sizeof(BLINK_CHUNK_BENCH) != len) {
+        blink_result_error("ERROR: Blink size mismatch");
+      } else {
+        blink_program_command_B(header);
+      }
+      break;
+    case BLINK_CMD_QUERY:
+      if (sizeof(BLINK_CHUNK_QUERY) != len) {
+        blink_result_error("ERROR: Blink size mismatch");
+      } else {
+        blink_program_command_Q(header);
+      }
+      break;
+    case BLINK_CMD_UPLOAD:
+      if (sizeof(BLINK_CHUNK_UPLOAD) != len) {
+        blink_result_error("ERROR: Blink size mismatch");
+      } else {
+        blink_program_command_U(header);
+      }
+      break;
+    case BLINK_CMD_PROFILE:
+      if (sizeof(BLINK_CHUNK_PROFILE) != len) {
+        blink_result_error("ERROR: Blink size mismatch");
+      } else {
+        blink_program_command_S(header);
+      }
+      break;
+    case BLINK_CMD_BATCH:
+      blink_program_command_G(session, header, len);
+      blink_flow_consume(header->version, 0, kCredits);
+      break;
+    default:
+      blink_result_error("ERROR: Blink unknown type");
+  }
+}
+
+/**
+ * @brief Callback for program characteristic write operations
+ *
+ * @param conn Bluetooth connection handle
+ * @param attr GATT attribute being written to
+ * @param buf Buffer containing the data to write
+ * @param len Length of the data
+ * @param offset Offset to start writing at
+ * @param flags Write operation flags
+ * @return ssize_t Number of bytes written
+ */
+static ssize_t blink_write_program(struct bt_conn *conn,
+                                   const struct bt_gatt_attr *attr,
+                                   const void *buf, uint16_t len,
+                                   uint16_t offset, uint8_t flags) {
+  ARG_UNUSED(attr);
+  ARG_UNUSED(offset);
+  ARG_UNUSED(flags);
+
+  blink_dispatch(blink_get_session(conn), (BLINK_CHUNK_HEADER *)buf, len,
+                 true);
+  return len;
+}
+
+/**
+ * @brief Fills a snapshot of the status characteristic
+ *
+ * @param conn Bluetooth connection handle of the reader
+ * @param session Upload session of the reader, or NULL
+ * @param value Snapshot to fill
+ */
+static void blink_status_fill(struct bt_conn *conn,
+                              const blink_session_t *const session,
+                              BLINK_STATUS_VALUE *const value) {
+  BLE_PARAM param = {
+      .event = BLE_EVENT_STATUS,
+      .status.mtu = bt_gatt_get_mtu(conn),
+  };
+  ble_context.event_cb(&param);
+
+  memset(value, 0x00, sizeof(*value));
+  BLINK_STATUS *const status = &value->status;
+  *status = (BLINK_STATUS){
+      .mtu = param.status.mtu,
+      .credits = BLINK_CREDIT_WINDOW,
+      .bench_mode = blink_bench.mode,
+      .throughput = (NULL != session) ? session->flow.throughput : 0,
+      .bench_bytes = blink_bench.bytes,
+      .bench_throughput = blink_bench_throughput(),
+      .version = BLINK_STATUS_VERSION,
+      .vm_state = param.status.vm_state,
+      .vm_restarts = param.status.vm_restarts,
+      .heap_used = param.status.heap_used,
+      .heap_free = param.status.heap_free,
+      .heap_peak = param.status.heap_peak,
+      .stack_peak = param.status.stack_peak,
+      .stack_size = param.status.stack_size,
+      .storage_free = param.status.storage_free,
+      .uptime = param.status.uptime,
+      .reset_cause = param.status.reset_cause,
+      .first_write = (NULL != session) ? session->first_write : 0,
+      .slot_count = BLE_STATUS_SLOT_COUNT,
+  };
+  for (size_t i = 0; i < BLE_STATUS_SLOT_COUNT; i++) {
+    BLINK_STATUS_SLOT *const slot = (i < BLINK_STATUS_SLOTS)
+                                        ? &status->slots[i]
+                                        : &value->more[i - BLINK_STATUS_SLOTS];
+    slot->length = param.status.slot_length[i];
+    slot->crc = param.status.slot_crc[i];
+  }
+  struct bt_conn_info info;
+  if (0 == bt_conn_get_info(conn, &info)) {
+    status->interval = info.le.interval;
+    status->tx_phy = info.le.phy->tx_phy;
+    status->rx_phy = info.le.phy->rx_phy;
+    status->tx_data_len = info.le.data_len->tx_max_len;
+    status->rx_data_len = info.le.data_len->rx_max_len;
+  }
+}
+
+/**
+ * @brief Callback for status characteristic read operations
+ *
+ * @details Reading the status grants the full credit window of the reading
+ * connection, so a host reads it before starting an upload. The status is
+ * longer than most MTUs, so a read at offset 0 takes a snapshot in the
+ * session of the reader and the following read requests return the rest of
+ * that snapshot; the VM and storage are queried once per read.
+ *
+ * @param conn Bluetooth connection handle
+ * @param attr GATT attribute being read from
+ * @param buf Buffer to store the read data
+ * @param len Maximum length of the buffer
+ * @param offset Offset to start reading from
+ * @return ssize_t Number of bytes read
+ */
+static ssize_t blink_read_mtu(struct bt_conn *conn,
+                              const struct bt_gatt_attr *attr, void *buf,
+                              uint16_t len, uint16_t offset) {
+  blink_session_t *session = blink_get_session(conn);
+  BLINK_STATUS_VALUE value;
+  BLINK_STATUS_VALUE *snapshot = &value;
+  if (NULL != session) {
+    snapshot = &session->status;
+    if (0 == offset) {
+      blink_flow_reset(session);
+    }
+  }
+  if ((NULL == session) || (0 == offset)) {
+    blink_status_fill(conn, session, snapshot);
+  }
+  return bt_gatt_attr_read(
+      conn, attr, buf, len, offset, snapshot,
+      sizeof(BLINK_STATUS) +
+          (BLINK_STATUS_MORE_SLOTS * sizeof(BLINK_STATUS_SLOT)));
+}
+
+/**
+ * @brief Callback for slot characteristic read operations
+ *
+ * @details The value is a BLINK_SLOT_HEADER followed by the page of the
+ * stored bytecode selected by the reading connection, at most
+ * BLINK_SLOT_VALUE_SIZE bytes in total. A read at offset 0 takes the length
+ * and CRC16 of the slot for the header; the bytecode is read from the slot
+ * for each request, so no copy of it is kept in RAM.
+ *
+ * @param conn Bluetooth connection handle
+ * @param attr GATT attribute being read from
+ * @param buf Buffer to store the read data
+ * @param len Maximum length of the buffer
+ * @param offset Offset to start reading from
+ * @return ssize_t Number of bytes read, or a GATT error
+ */
+static ssize_t blink_read_slot(struct bt_conn *conn,
+                               const struct bt_gatt_attr *attr, void *buf,
+                               uint16_t len, uint16_t offset) {
+  ARG_UNUSED(attr);
+
+  blink_session_t *session = blink_get_session(conn);
+  if (NULL == session) {
+    return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+  }
+  if (0 == offset) {
+    BLE_PARAM param = {
+        .event = BLE_EVENT_SLOT_READ,
+        .slot_read.slot = session->readback.slot,
+    };
+    if (0 != ble_context.event_cb(&param)) {
+      return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+    }
+    session->readback.length =
+        (0 < param.slot_read.length) ? param.slot_read.length : 0;
+    session->readback.crc = param.slot_read.crc;
+  }
+
+  const BLINK_SLOT_HEADER kHeader = {
+      .slot = session->readback.slot,
+      .length = session->readback.length,
+      .crc = session->readback.crc,
+      .offset = session->readback.offset,
+  };
+  const size_t kPage =
+      (kHeader.offset < kHeader.length)
+          ? MIN(kHeader.length - kHeader.offset, BLINK_SLOT_PAGE_SIZE)
+          : 0;
+  const size_t kTotal = sizeof(kHeader) + kPage;
+  if (offset > kTotal) {
+    return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
   }
 
-  // Clear the buffer
-  memset(&blink_bytecode, 0, sizeof(blink_bytecode));
-  return 0;
+  const size_t kSize = MIN(len, kTotal - offset);
+  uint8_t *out = buf;
+  size_t done = 0;
+  if (offset < sizeof(kHeader)) {
+    done = MIN(kSize, sizeof(kHeader) - offset);
+    memcpy(out, (const uint8_t *)&kHeader + offset, done);
+  }
+  if (done < kSize) {
+    BLE_PARAM param = {
+        .event = BLE_EVENT_SLOT_READ,
+        .slot_read.slot = kHeader.slot,
+        .slot_read.offset = kHeader.offset + (offset + done - sizeof(kHeader)),
+        .slot_read.buffer = &out[done],
+        .slot_read.size = kSize - done,
+    };
+    if ((0 != ble_context.event_cb(&param)) ||
+        (param.slot_read.length != (ssize_t)(kSize - done))) {
+      return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+    }
+  }
+  return kSize;
 }
 
 /**
- * @brief Callback for program characteristic write operations
+ * @brief Callback for slot characteristic write operations
+ *
+ * @details Selects the slot and the page that the writing connection reads
+ * back, as a BLINK_SLOT_SELECT or just the slot number for the first page.
  *
  * @param conn Bluetooth connection handle
  * @param attr GATT attribute being written to
- * @param buf Buffer containing the data to write
+ * @param buf Buffer containing the selection
  * @param len Length of the data
  * @param offset Offset to start writing at
  * @param flags Write operation flags
- * @return ssize_t Number of bytes written
+ * @return ssize_t Number of bytes written, or a GATT error
  */
-static ssize_t blink_write_program(struct bt_conn *conn,
-                                   const struct bt_gatt_attr *attr,
-                                   const void *buf, uint16_t len,
-                                   uint16_t offset, uint8_t flags) {
+static ssize_t blink_write_slot(struct bt_conn *conn,
+                                const struct bt_gatt_attr *attr,
+                                const void *buf, uint16_t len,
+                                uint16_t offset, uint8_t flags) {
   ARG_UNUSED(attr);
-  ARG_UNUSED(offset);
   ARG_UNUSED(flags);
 
-  BLINK_CHUNK_HEADER *header = (BLINK_CHUNK_HEADER *)buf;
-  LOG_DBG("BLE: Blink Command [%c]", header->command);
-
-  // Check the version
-  if (header->version != BLINK_VERSION) {
-    blink_result_error("ERROR: Blink version mismatch");
+  blink_session_t *session = blink_get_session(conn);
+  if ((0 != offset) ||
+      ((sizeof(uint8_t) != len) && (sizeof(BLINK_SLOT_SELECT) != len))) {
+    return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
   }
-
-  switch (header->command) {
-    case BLINK_CMD_DATA:
-      blink_program_command_D(header, len);
-      break;
-    case BLINK_CMD_PROG:
-      if (sizeof(BLINK_CHUNK_PROGRAM) != len) {
-        blink_result_error("ERROR: Blink size mismatch");
-      } else {
-        blink_program_command_P(header);
-      }
-      break;
-    case BLINK_CMD_RESET:
-      BLE_PARAM param_reset = {
-          .event = BLE_EVENT_REBOOT,
-      };
-      ble_context.event_cb(&param_reset);
-      break;
-    case BLINK_CMD_RELOAD:
-      BLE_PARAM param_reload = {
-          .event = BLE_EVENT_RELOAD,
-      };
-      ble_context.event_cb(&param_reload);
-      break;
-    default:
-      blink_result_error("ERROR: Blink unknown type");
+  BLINK_SLOT_SELECT select = {0};
+  memcpy(&select, buf, len);
+  if ((NULL == session) || !blink_slot_is_valid((blink_slot_t)select.slot)) {
+    return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
   }
-
+  session->readback.slot = select.slot;
+  session->readback.offset = select.offset;
   return len;
 }
 
 /**
- * @brief Callback for status characteristic read operations
+ * @brief Callback for benchmark characteristic write operations
+ *
+ * @details Counts the bytes written by the connection that started the
+ * benchmark while it is in sink mode.
  *
  * @param conn Bluetooth connection handle
- * @param attr GATT attribute being read from
- * @param buf Buffer to store the read data
- * @param len Maximum length of the buffer
- * @param offset Offset to start reading from
- * @return ssize_t Number of bytes read
+ * @param attr GATT attribute being written to
+ * @param buf Buffer containing the data to write
+ * @param len Length of the data
+ * @param offset Offset to start writing at
+ * @param flags Write operation flags
+ * @return ssize_t Number of bytes written
  */
-static ssize_t blink_read_mtu(struct bt_conn *conn,
-                              const struct bt_gatt_attr *attr, void *buf,
-                              uint16_t len, uint16_t offset) {
-  BLE_PARAM param = {
-      .event = BLE_EVENT_STATUS,
-      .status.mtu = bt_gatt_get_mtu(conn),
-  };
-  ble_context.event_cb(&param);
+static ssize_t blink_write_bench(struct bt_conn *conn,
+                                 const struct bt_gatt_attr *attr,
+                                 const void *buf, uint16_t len,
+                                 uint16_t offset, uint8_t flags) {
+  ARG_UNUSED(attr);
+  ARG_UNUSED(buf);
+  ARG_UNUSED(offset);
+  ARG_UNUSED(flags);
 
-  return bt_gatt_attr_read(conn, attr, buf, len, offset, &param.status.mtu,
-                           sizeof(param.status.mtu));
+  if ((BLINK_BENCH_MODE_SINK == blink_bench.mode) &&
+      (conn == blink_bench.conn)) {
+    const uint32_t kNow = k_uptime_get_32();
+    if (0 == blink_bench.bytes) {
+      blink_bench.start = kNow;
+    }
+    blink_bench.bytes += len;
+    blink_bench.last = kNow;
+  }
+  return len;
 }
 
 /**
@@ -312,14 +1684,28 @@ static struct bt_gatt_attr attrs[] = {
                            BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_NONE, NULL, NULL,
                            NULL),
     BT_GATT_CCC(on_cccd_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
-    // Program: 4, [5]
+    // Program: 4, [5], 6
     BT_GATT_CHARACTERISTIC(BT_UUID_OPEN_BLINK_PROGRAM_CHARACTERISTIC_UUID,
-                           BT_GATT_CHRC_WRITE | BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+                           BT_GATT_CHRC_WRITE |
+                               BT_GATT_CHRC_WRITE_WITHOUT_RESP |
+                               BT_GATT_CHRC_NOTIFY,
                            BT_GATT_PERM_WRITE, NULL, blink_write_program, NULL),
-    // MTU: 6, [7]
+    BT_GATT_CCC(on_cccd_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+    // MTU: 7, [8]
     BT_GATT_CHARACTERISTIC(BT_UUID_OPEN_BLINK_STATUS_CHARACTERISTIC_UUID,
                            BT_GATT_CHRC_READ, BT_GATT_PERM_READ, blink_read_mtu,
                            NULL, NULL),
+    // Benchmark: 9, [10], 11
+    BT_GATT_CHARACTERISTIC(BT_UUID_OPEN_BLINK_BENCH_CHARACTERISTIC_UUID,
+                           BT_GATT_CHRC_WRITE_WITHOUT_RESP |
+                               BT_GATT_CHRC_NOTIFY,
+                           BT_GATT_PERM_WRITE, NULL, blink_write_bench, NULL),
+    BT_GATT_CCC(on_cccd_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+    // Slot: 12, [13]
+    BT_GATT_CHARACTERISTIC(BT_UUID_OPEN_BLINK_SLOT_CHARACTERISTIC_UUID,
+                           BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+                           blink_read_slot, blink_write_slot, NULL),
 };
 
 /** @brief Index of console characteristic in the attributes array */
@@ -327,7 +1713,11 @@ static struct bt_gatt_attr attrs[] = {
 /** @brief Index of program characteristic in the attributes array */
 #define SERVICE_BLINK_PROGRAM 5  // [5]
 /** @brief Index of status characteristic in the attributes array */
-#define SERVICE_BLINK_STATUS 7  // [7]
+#define SERVICE_BLINK_STATUS 8  // [8]
+/** @brief Index of benchmark characteristic in the attributes array */
+#define SERVICE_BLINK_BENCH 10  // [10]
+/** @brief Index of slot characteristic in the attributes array */
+#define SERVICE_BLINK_SLOT 13  // [13]
 
 /** @brief GATT service definition */
 static struct bt_gatt_service service = BT_GATT_SERVICE(attrs);
@@ -339,13 +1729,26 @@ static struct bt_gatt_service service = BT_GATT_SERVICE(attrs);
  * @return int 0 on success, negative on error
  */
 static int notify_blink_program(const char *data) {
+  return notify_blink_program_data(data, strlen(data));
+}
+
+/**
+ * @brief Sends binary data as a notification through the program
+ * characteristic
+ *
+ * @param kData Data to send
+ * @param kSize Size of the data
+ * @return int 0 on success, negative on error
+ */
+static int notify_blink_program_data(const void *const kData,
+                                     const uint16_t kSize) {
   int err = 0;
   const struct bt_gatt_attr *attr = &attrs[SERVICE_BLINK_PROGRAM];
+  struct bt_conn *conn = blink_session->conn;
 
-  if (bt_gatt_is_subscribed(ble_context.conn, attr, BT_GATT_CCC_NOTIFY)) {
-    size_t size = strlen(data);
-
-    err = bt_gatt_notify(ble_context.conn, attr, data, size);
+  if ((NULL != conn) &&
+      bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY)) {
+    err = bt_gatt_notify(conn, attr, kData, kSize);
     if (err) {
       LOG_ERR("BLE: unable to send notification");
     }
@@ -353,6 +1756,74 @@ static int notify_blink_program(const char *data) {
   return err;
 }
 
+/**
+ * @brief Work handler that streams benchmark notifications
+ *
+ * @details Sends notifications of MTU-3 bytes until the requested length is
+ * reached. When the stack runs out of buffers, it retries 1 ms later. The
+ * connection is looked up again on each run and held until the run ends, so
+ * a disconnect in between stops the benchmark instead of leaving a stale
+ * pointer.
+ *
+ * @param work Work item that triggered the handler
+ */
+static void blink_bench_source(struct k_work *work) {
+  static uint8_t packet[BLINK_CONSOLE_PACKET_SIZE];
+  struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+  const struct bt_gatt_attr *attr = &attrs[SERVICE_BLINK_BENCH];
+
+  struct bt_conn *conn = ble_get_conn(blink_bench.index);
+  if ((NULL != conn) && (conn != blink_bench.conn)) {
+    bt_conn_unref(conn);
+    conn = NULL;
+  }
+
+  if ((BLINK_BENCH_MODE_SOURCE != blink_bench.mode) || (NULL == conn) ||
+      !bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY)) {
+    blink_bench.mode = BLINK_BENCH_MODE_STOP;
+    if (NULL != conn) {
+      bt_conn_unref(conn);
+    }
+    return;
+  }
+
+  const uint16_t kMtu = bt_gatt_get_mtu(conn);
+  const uint32_t kMax =
+      MIN((uint32_t)MAX(kMtu, 4) - 3, (uint32_t)sizeof(packet));
+  while (blink_bench.bytes < blink_bench.length) {
+    const uint32_t kSize = MIN(kMax, blink_bench.length - blink_bench.bytes);
+    for (uint32_t i = 0; i < kSize; i++) {
+      packet[i] = (uint8_t)(blink_bench.bytes + i);
+    }
+    int err = bt_gatt_notify(conn, attr, packet, kSize);
+    if (-ENOMEM == err) {
+      k_work_schedule(dwork, K_MSEC(1));
+      bt_conn_unref(conn);
+      return;
+    }
+    if (err) {
+      LOG_ERR("BLE: benchmark notification failed (err %d)", err);
+      break;
+    }
+    blink_bench.bytes += kSize;
+    blink_bench.last = k_uptime_get_32();
+  }
+  LOG_INF("BLE: benchmark sent %u bytes (%u bytes/s)", blink_bench.bytes,
+          blink_bench_throughput());
+  blink_bench.mode = BLINK_BENCH_MODE_STOP;
+  bt_conn_unref(conn);
+}
+
+/** @brief Delayed work that streams benchmark notifications */
+static K_WORK_DELAYABLE_DEFINE(blink_bench_work, blink_bench_source);
+
+/**
+ * @brief Starts streaming benchmark notifications
+ */
+static void blink_bench_start_source(void) {
+  k_work_reschedule(&blink_bench_work, K_NO_WAIT);
+}
+
 /**
  * @brief Initializes the BLE Blink service
  *
@@ -361,6 +1832,10 @@ static int notify_blink_program(const char *data) {
  * @return int 0 on success, negative on error
  */
 int ble_blink_init() {
+  for (size_t i = 0; i < ARRAY_SIZE(blink_sessions); i++) {
+    blink_sessions[i].staging = i;
+  }
+
   int err = bt_gatt_service_register(&service);
   if (err) {
     LOG_ERR("BLE: Blink service register error %d", err);
@@ -368,24 +1843,392 @@ int ble_blink_init() {
   return err;
 }
 
+/**
+ * @brief Starts the upload session of a new connection
+ *
+ * @param conn Bluetooth connection handle
+ */
+void ble_blink_connected(struct bt_conn *conn) {
+  blink_session_t *session = &blink_sessions[bt_conn_index(conn)];
+  const uint8_t kStaging = session->staging;
+  memset(session, 0x00, sizeof(*session));
+  session->conn = conn;
+  session->staging = kStaging;
+  session->readback.slot = kBlinkSlot1;
+  session->connected = k_uptime_get_32();
+  staging_reset(kStaging);
+}
+
+/**
+ * @brief Ends the upload session of a terminated connection
+ *
+ * @details Parks an identified upload that was not committed, replacing an
+ * upload parked before, and discards any other staged upload. Stops a
+ * benchmark started by the connection.
+ *
+ * @param conn Bluetooth connection handle
+ */
+void ble_blink_disconnected(struct bt_conn *conn) {
+  blink_session_t *session = blink_get_session(conn);
+  if (NULL != session) {
+    if (session->upload.active) {
+      LOG_INF("BLE: Blink upload %d parked", session->upload.id);
+      staging_reset(blink_parked.staging);
+      blink_swap_parked(session);
+      blink_parked.upload = session->upload;
+      session->upload.active = false;
+    }
+    staging_reset(session->staging);
+    session->expected.active = false;
+    session->conn = NULL;
+    session->compressed.active = false;
+  }
+  if (conn == blink_bench.conn) {
+    blink_bench.mode = BLINK_BENCH_MODE_STOP;
+    blink_bench.conn = NULL;
+  }
+}
+
+/**
+ * @brief Processes a Blink command received over an L2CAP channel
+ *
+ * @details Results are notified through the program characteristic as for
+ * GATT writes. The channel has its own credits, so no credit notifications
+ * are sent.
+ *
+ * @param conn Connection of the channel
+ * @param data Command data
+ * @param len Length of the command data
+ */
+void ble_blink_receive(struct bt_conn *conn, const void *data, uint16_t len) {
+  blink_dispatch(blink_get_session(conn), (BLINK_CHUNK_HEADER *)data, len,
+                 false);
+}
+
+/**
+ * @brief Collects a broadcast data chunk (BLINK_CMD_DATA)
+ *
+ * @details The same chunks arrive in every broadcast cycle, so a chunk at
+ * offset 0 does not restart the upload and chunks already staged are skipped
+ * by the staging area. Nothing is staged once the announced program is
+ * committed.
+ *
+ * @param header Pointer to the command header
+ * @param len Total length of the received data
+ */
+static void blink_broadcast_data(BLINK_CHUNK_HEADER *header, uint16_t len) {
+  BLINK_CHUNK_DATA *data_chunk = (BLINK_CHUNK_DATA *)header;
+
+  if (blink_broadcast.done || (sizeof(BLINK_CHUNK_DATA) > len) ||
+      (sizeof(BLINK_CHUNK_DATA) + data_chunk->size != len) ||
+      (data_chunk->offset + data_chunk->size > BLINK_MAX_BYTECODE_SIZE)) {
+    return;
+  }
+  int err = staging_write(BLINK_BROADCAST_SESSION, data_chunk->offset,
+                          data_chunk + 1, data_chunk->size);
+  if ((0 != err) && (-EINVAL != err)) {
+    LOG_ERR("BROADCAST: staging error %d", err);
+  }
+}
+
+/**
+ * @brief Commits the broadcast upload once it is complete
+ *
+ * @details The program is committed when every chunk has been collected and
+ * the CRC16 matches, then the VM is reloaded. Repeats of the same 'P'rogram
+ * command are ignored; a different one starts collecting a new upload. A CRC
+ * mismatch discards the collected data, so the next cycle starts over.
+ *
+ * @param header Pointer to the command header
+ */
+static void blink_broadcast_program(BLINK_CHUNK_HEADER *header) {
+  BLINK_CHUNK_PROGRAM *p = (BLINK_CHUNK_PROGRAM *)header;
+
+  if (blink_broadcast.done) {
+    if ((blink_broadcast.slot == p->slot) &&
+        (blink_broadcast.length == p->length) &&
+        (blink_broadcast.crc == p->crc)) {
+      return;
+    }
+    LOG_INF("BROADCAST: new program slot:%d size:%d", p->slot, p->length);
+    blink_broadcast.done = false;
+    staging_reset(BLINK_BROADCAST_SESSION);
+    return;
+  }
+  if ((p->length > BLINK_MAX_BYTECODE_SIZE) ||
+      !blink_slot_is_valid((blink_slot_t)p->slot)) {
+    return;
+  }
+
+  uint16_t crc16 = 0;
+  int rc = staging_finish(BLINK_BROADCAST_SESSION, p->length, &crc16);
+  if (-ENODATA == rc) {
+    return;
+  } else if ((0 == rc) && (crc16 == p->crc)) {
+    BLE_PARAM param = {
+        .event = BLE_EVENT_BLINK,
+        .blink.blink_bytecode =
+            (uint8_t *)staging_get_image(BLINK_BROADCAST_SESSION),
+        .blink.slot = p->slot,
+        .blink.length = p->length,
+    };
+    if (0 == ble_context.event_cb(&param)) {
+      LOG_INF("BROADCAST: committed slot:%d size:%d CRC16:0x%04X", p->slot,
+              p->length, p->crc);
+      blink_broadcast.done = true;
+      blink_broadcast.slot = p->slot;
+      blink_broadcast.length = p->length;
+      blink_broadcast.crc = p->crc;
+
+      BLE_PARAM param_reload = {
+          .event = BLE_EVENT_RELOAD,
+          .reload.slot = p->slot,
+      };
+      ble_context.event_cb(&param_reload);
+    } else {
+      LOG_ERR("BROADCAST: program error");
+    }
+  } else {
+    LOG_WRN("BROADCAST: CRC16 0x%04X != 0x%04X (rc %d)", crc16, p->crc, rc);
+  }
+  staging_reset(BLINK_BROADCAST_SESSION);
+}
+
+/**
+ * @brief Processes a Blink command received over periodic advertising
+ *
+ * @details Only version 1 'D'ata and 'P'rogram commands are accepted. There
+ * is no connection to report errors to, so they are only logged.
+ *
+ * @param data Command data
+ * @param len Length of the command data
+ */
+void ble_blink_receive_broadcast(const void *data, uint16_t len) {
+  BLINK_CHUNK_HEADER *header = (BLINK_CHUNK_HEADER *)data;
+
+  blink_session = &blink_sessions[BLINK_BROADCAST_SESSION];
+  if ((sizeof(BLINK_CHUNK_HEADER) > len) ||
+      (BLINK_VERSION != header->version)) {
+    return;
+  }
+  switch (header->command) {
+    case BLINK_CMD_DATA:
+      blink_broadcast_data(header, len);
+      break;
+    case BLINK_CMD_PROG:
+      if (sizeof(BLINK_CHUNK_PROGRAM) == len) {
+        blink_broadcast_program(header);
+      }
+      break;
+    default:
+      LOG_DBG("BROADCAST: command [%c] ignored", header->command);
+      break;
+  }
+}
+
+/**
+ * @brief Sends buffered console output to the subscribed connections
+ *
+ * @details If the stack is out of buffers, the connections that have not
+ * received the packet yet get it later, so a slow subscriber holds back the
+ * others.
+ *
+ * @param dwork Delayed work to reschedule when out of buffers
+ * @param conns Connections indexed by bt_conn_index(), NULL if unused
+ * @param kSubscribers Bits of the connections that subscribed
+ * @param kMtu Smallest MTU of the subscribed connections
+ */
+static void blink_console_send(struct k_work_delayable *dwork,
+                               struct bt_conn *const conns[BLE_MAX_CONN],
+                               const uint32_t kSubscribers,
+                               const uint16_t kMtu) {
+  static uint8_t packet[BLINK_CONSOLE_PACKET_SIZE];
+  const struct bt_gatt_attr *attr = &attrs[SERVICE_BLINK_CONSOLE];
+
+  const uint32_t kMax =
+      MIN((uint32_t)MAX(kMtu, 4) - 3, (uint32_t)sizeof(packet));
+  blink_console.payload = kMax;
+  while (true) {
+    // A packet that some subscribers already got is resent unchanged
+    const uint32_t kWant =
+        (0 < blink_console.head) ? blink_console.head : kMax;
+    k_spinlock_key_t key = k_spin_lock(&blink_console.lock);
+    const uint32_t kSize = ring_buf_peek(&blink_console_ring, packet, kWant);
+    const uint32_t kDropped = blink_console.dropped;
+    blink_console.dropped = 0;
+    k_spin_unlock(&blink_console.lock, key);
+
+    if (0 < kDropped) {
+      LOG_WRN("BLE: console dropped %u bytes", kDropped);
+    }
+    if (0 == kSize) {
+      return;
+    }
+    blink_console.head = kSize;
+    for (size_t i = 0; i < BLE_MAX_CONN; i++) {
+      if (0 == ((kSubscribers & ~blink_console.sent) & BIT(i))) {
+        continue;
+      }
+      int err = bt_gatt_notify(conns[i], attr, packet, kSize);
+      if (-ENOMEM == err) {
+        // Out of TX buffers, retry once the link has caught up
+        k_work_schedule(dwork, K_MSEC(BLINK_CONSOLE_FLUSH_MS));
+        return;
+      }
+      if (err) {
+        LOG_ERR("BLE: unable to send notification");
+      }
+      blink_console.sent |= BIT(i);
+    }
+    blink_console.head = 0;
+    blink_console.sent = 0;
+
+    key = k_spin_lock(&blink_console.lock);
+    ring_buf_get(&blink_console_ring, NULL, kSize);
+    k_spin_unlock(&blink_console.lock, key);
+    k_sem_give(&blink_console_space);
+  }
+}
+
+/**
+ * @brief Work handler that sends buffered console output
+ *
+ * @details Packs the buffered output into notifications of up to MTU-3 bytes
+ * of the smallest MTU and sends each one to every subscribed connection. The
+ * connections are held until the output is sent, so a disconnect meanwhile
+ * only fails the notification. Output is discarded while nobody is
+ * subscribed, as before buffering.
+ *
+ * @param work Work item that triggered the handler
+ */
+static void blink_console_flush(struct k_work *work) {
+  struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+  const struct bt_gatt_attr *attr = &attrs[SERVICE_BLINK_CONSOLE];
+
+  struct bt_conn *conns[BLE_MAX_CONN] = {NULL};
+  uint32_t subscribers = 0;
+  uint16_t mtu = UINT16_MAX;
+  for (size_t i = 0; i < BLE_MAX_CONN; i++) {
+    conns[i] = ble_get_conn(i);
+    if ((NULL != conns[i]) &&
+        bt_gatt_is_subscribed(conns[i], attr, BT_GATT_CCC_NOTIFY)) {
+      subscribers |= BIT(i);
+      mtu = MIN(mtu, bt_gatt_get_mtu(conns[i]));
+    }
+  }
+
+  if (0 == subscribers) {
+    k_spinlock_key_t key = k_spin_lock(&blink_console.lock);
+    ring_buf_reset(&blink_console_ring);
+    k_spin_unlock(&blink_console.lock, key);
+    blink_console.head = 0;
+    blink_console.sent = 0;
+    k_sem_give(&blink_console_space);
+  } else {
+    blink_console_send(dwork, conns, subscribers, mtu);
+  }
+
+  for (size_t i = 0; i < BLE_MAX_CONN; i++) {
+    if (NULL != conns[i]) {
+      bt_conn_unref(conns[i]);
+    }
+  }
+}
+
+/** @brief Delayed work that sends buffered console output */
+static K_WORK_DELAYABLE_DEFINE(blink_console_work, blink_console_flush);
+
+/**
+ * @brief Buffers console output and schedules it to be sent
+ *
+ * @details The output is sent from the system work queue, either after
+ * BLINK_CONSOLE_FLUSH_MS or as soon as a full notification is buffered.
+ *
+ * @param kData Data to send
+ * @param kLength Length of the data
+ * @return size_t Number of bytes buffered
+ */
+static size_t blink_console_put(const uint8_t *const kData,
+                                const size_t kLength) {
+  k_spinlock_key_t key = k_spin_lock(&blink_console.lock);
+  const uint32_t kPut = ring_buf_put(&blink_console_ring, kData, kLength);
+  const uint32_t kBuffered = ring_buf_size_get(&blink_console_ring);
+  k_spin_unlock(&blink_console.lock, key);
+
+  if ((kBuffered >= blink_console.payload) || (kPut < kLength)) {
+    k_work_reschedule(&blink_console_work, K_NO_WAIT);
+  } else {
+    k_work_schedule(&blink_console_work, K_MSEC(BLINK_CONSOLE_FLUSH_MS));
+  }
+  return kPut;
+}
+
+/**
+ * @brief Counts console bytes dropped because the buffer was full
+ *
+ * @param kLength Number of bytes dropped
+ */
+static void blink_console_drop(const size_t kLength) {
+  k_spinlock_key_t key = k_spin_lock(&blink_console.lock);
+  blink_console.dropped += kLength;
+  k_spin_unlock(&blink_console.lock, key);
+}
+
 /**
  * @brief Sends a string over BLE console characteristic
  *
+ * @details Never blocks. Bytes that do not fit into the buffer are dropped
+ * and counted.
+ *
  * @param data String to send
- * @return int 0 on success, negative on error
+ * @return int 0 on success, -ENOMEM if the string was truncated
  */
 int ble_print(const char *data) {
-  int err = 0;
-  const struct bt_gatt_attr *attr = &attrs[SERVICE_BLINK_CONSOLE];
-
-  if (bt_gatt_is_subscribed(ble_context.conn, attr, BT_GATT_CCC_NOTIFY)) {
-    size_t size = strlen(data);
+  const size_t kLength = strlen(data);
+  const size_t kPut = blink_console_put((const uint8_t *)data, kLength);
+  if (kPut < kLength) {
+    blink_console_drop(kLength - kPut);
+    return -ENOMEM;
+  }
+  return 0;
+}
 
-    err = bt_gatt_notify(ble_context.conn, attr, data, size);
-    if (err) {
-      LOG_ERR("BLE: unable to send notification");
+/**
+ * @brief Sends data over BLE console characteristic
+ *
+ * @details Unlike ble_print(), the data may contain NUL bytes and be larger
+ * than the console buffer. When the buffer is full, the caller waits while
+ * the buffered output is sent. If no space is freed within
+ * BLINK_CONSOLE_WRITE_TIMEOUT_MS, the rest is dropped. Must not be called
+ * from the system work queue or an ISR.
+ *
+ * @param data Data to send
+ * @param len Length of the data
+ * @return size_t Number of bytes buffered
+ */
+size_t ble_write(const void *data, size_t len) {
+  const uint8_t *src = (const uint8_t *)data;
+  size_t written = 0;
+  while (written < len) {
+    k_sem_reset(&blink_console_space);
+    written += blink_console_put(&src[written], len - written);
+    if ((written < len) &&
+        (0 != k_sem_take(&blink_console_space,
+                         K_MSEC(BLINK_CONSOLE_WRITE_TIMEOUT_MS)))) {
+      blink_console_drop(len - written);
+      break;
     }
   }
+  return written;
+}
 
-  return err;
+/**
+ * @brief Sends buffered console output and waits for completion
+ *
+ * @details Must not be called from the system work queue.
+ */
+void ble_print_flush(void) {
+  struct k_work_sync sync;
+  k_work_reschedule(&blink_console_work, K_NO_WAIT);
+  k_work_flush_delayable(&blink_console_work, &sync);
 }
@@ -10,7 +10,9 @@
 #ifndef DRV_BLE_BLINK_H
 #define DRV_BLE_BLINK_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/uuid.h>
 
 /**
@@ -29,11 +31,59 @@
 int ble_blink_init();
 
 /**
- * @brief Sends a string over BLE console characteristic
+ * @brief Starts the upload session of a new connection
+ *
+ * @param conn Bluetooth connection handle
+ */
+void ble_blink_connected(struct bt_conn *conn);
+
+/**
+ * @brief Ends the upload session of a terminated connection
+ *
+ * @param conn Bluetooth connection handle
+ */
+void ble_blink_disconnected(struct bt_conn *conn);
+
+/**
+ * @brief Processes a Blink command received over an L2CAP channel
+ *
+ * @param conn Connection of the channel
+ * @param data Command data
+ * @param len Length of the command data
+ */
+void ble_blink_receive(struct bt_conn *conn, const void *data, uint16_t len);
+
+/**
+ * @brief Processes a Blink command received over periodic advertising
+ *
+ * @param data Command data
+ * @param len Length of the command data
+ */
+void ble_blink_receive_broadcast(const void *data, uint16_t len);
+
+/**
+ * @brief Sends a string to every console subscriber
  *
  * @param data String to send
  * @return int 0 on success, negative on error
  */
 int ble_print(const char *data);
 
+/**
+ * @brief Sends data over BLE console characteristic
+ *
+ * @details The data may contain NUL bytes and be larger than the console
+ * buffer; the caller waits while buffered output is sent.
+ *
+ * @param data Data to send
+ * @param len Length of the data
+ * @return size_t Number of bytes buffered
+ */
+size_t ble_write(const void *data, size_t len);
+
+/**
+ * @brief Sends buffered console output and waits for completion
+ */
+void ble_print_flush(void);
+
 #endif  // DRV_BLE_BLINK_H
@@ -0,0 +1,251 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file ble_broadcast.c
+ * @brief Implementation of the Bluetooth Low Energy broadcast transport
+ * @details The host sends the 'D'ata and 'P'rogram commands of an upload in a
+ * loop over periodic advertising. Each OpenBlink service data element in the
+ * advertising data holds one command. The device scans for an extended
+ * advertiser with OpenBlink service data, synchronizes to its periodic train
+ * and stops scanning while the sync holds.
+ */
+#include "ble_broadcast.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "ble_blink.h"
+
+LOG_MODULE_REGISTER(ble_broadcast, LOG_LEVEL_DBG);
+
+/** @brief OpenBlink service UUID in advertising byte order */
+static const uint8_t ble_broadcast_uuid[] = {OPENBLINK_SERVICE_UUID};
+
+/** @brief Broadcast reception state */
+static struct {
+  volatile bool enabled;           /**< true while reception is allowed */
+  volatile bool synced;            /**< true while the sync is established */
+  bool scanning;                   /**< true while scanning for a broadcast */
+  struct bt_le_per_adv_sync *sync; /**< Sync being created or held */
+} ble_broadcast;
+
+/**
+ * @brief Starts or stops scanning and the sync to match the state
+ *
+ * @param work Work item that triggered the handler
+ */
+static void ble_broadcast_update(struct k_work *work);
+
+/** @brief Work item that applies the reception state */
+static K_WORK_DEFINE(ble_broadcast_work, ble_broadcast_update);
+
+/**
+ * @brief Checks an advertising data element for OpenBlink service data
+ *
+ * @param data Advertising data element
+ * @param user_data Set to true when the element matches
+ * @return true to continue parsing, false to stop
+ */
+static bool ble_broadcast_match(struct bt_data *data, void *user_data) {
+  bool *found = user_data;
+  if ((BT_DATA_SVC_DATA128 == data->type) &&
+      (sizeof(ble_broadcast_uuid) <= data->data_len) &&
+      (0 == memcmp(data->data, ble_broadcast_uuid,
+                   sizeof(ble_broadcast_uuid)))) {
+    *found = true;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Passes the command in an advertising data element to the service
+ *
+ * @param data Advertising data element
+ * @param user_data Unused
+ * @return true to continue parsing
+ */
+static bool ble_broadcast_command(struct bt_data *data, void *user_data) {
+  ARG_UNUSED(user_data);
+  bool found = false;
+  ble_broadcast_match(data, &found);
+  if (found) {
+    ble_blink_receive_broadcast(&data->data[sizeof(ble_broadcast_uuid)],
+                                data->data_len - sizeof(ble_broadcast_uuid));
+  }
+  return true;
+}
+
+/**
+ * @brief Scan callback for received advertising reports
+ *
+ * @details Creates a sync to the first periodic advertiser whose extended
+ * advertising data carries OpenBlink service data.
+ *
+ * @param info Advertiser information
+ * @param buf Advertising data
+ */
+static void ble_broadcast_scan_recv(const struct bt_le_scan_recv_info *info,
+                                    struct net_buf_simple *buf) {
+  if ((0 == info->interval) || !ble_broadcast.enabled ||
+      (NULL != ble_broadcast.sync)) {
+    return;
+  }
+
+  bool found = false;
+  struct net_buf_simple_state state;
+  net_buf_simple_save(buf, &state);
+  bt_data_parse(buf, ble_broadcast_match, &found);
+  net_buf_simple_restore(buf, &state);
+  if (!found) {
+    return;
+  }
+
+  struct bt_le_per_adv_sync_param param = {0};
+  bt_addr_le_copy(&param.addr, info->addr);
+  param.sid = info->sid;
+  param.skip = 0;
+  param.timeout = BLE_BROADCAST_SYNC_TIMEOUT;
+  int err = bt_le_per_adv_sync_create(&param, &ble_broadcast.sync);
+  if (err) {
+    LOG_WRN("BROADCAST: sync create failed (err %d)", err);
+    ble_broadcast.sync = NULL;
+  }
+}
+
+/** @brief Scan callbacks */
+static struct bt_le_scan_cb ble_broadcast_scan_cb = {
+    .recv = ble_broadcast_scan_recv,
+};
+
+/**
+ * @brief Callback for an established sync
+ *
+ * @param sync Periodic advertising sync
+ * @param info Sync information
+ */
+static void ble_broadcast_synced(struct bt_le_per_adv_sync *sync,
+                                 struct bt_le_per_adv_sync_synced_info *info) {
+  char addr[BT_ADDR_LE_STR_LEN];
+  bt_addr_le_to_str(info->addr, addr, sizeof(addr));
+  LOG_INF("BROADCAST: synced to %s sid:%d interval:%d", addr, info->sid,
+          info->interval);
+  ble_broadcast.synced = true;
+  k_work_submit(&ble_broadcast_work);
+}
+
+/**
+ * @brief Callback for a lost or cancelled sync
+ *
+ * @param sync Periodic advertising sync
+ * @param info Termination information
+ */
+static void ble_broadcast_term(
+    struct bt_le_per_adv_sync *sync,
+    const struct bt_le_per_adv_sync_term_info *info) {
+  LOG_INF("BROADCAST: sync terminated (reason %d)", info->reason);
+  if (sync == ble_broadcast.sync) {
+    ble_broadcast.sync = NULL;
+    ble_broadcast.synced = false;
+  }
+  k_work_submit(&ble_broadcast_work);
+}
+
+/**
+ * @brief Callback for received periodic advertising data
+ *
+ * @details Incomplete reports are dropped; the host repeats every command.
+ *
+ * @param sync Periodic advertising sync
+ * @param info Report information
+ * @param buf Advertising data
+ */
+static void ble_broadcast_recv(
+    struct bt_le_per_adv_sync *sync,
+    const struct bt_le_per_adv_sync_recv_info *info,
+    struct net_buf_simple *buf) {
+  if (!ble_broadcast.enabled ||
+      (BT_HCI_LE_ADV_EVT_TYPE_DATA_STATUS_COMPLETE != info->data_status)) {
+    return;
+  }
+  bt_data_parse(buf, ble_broadcast_command, NULL);
+}
+
+/** @brief Periodic advertising sync callbacks */
+static struct bt_le_per_adv_sync_cb ble_broadcast_sync_cb = {
+    .synced = ble_broadcast_synced,
+    .term = ble_broadcast_term,
+    .recv = ble_broadcast_recv,
+};
+
+/**
+ * @brief Starts or stops scanning and the sync to match the state
+ *
+ * @details Scanning continues while a sync is being created, since the sync
+ * is established from the scanner. Runs on the system work queue, so the HCI
+ * commands are not issued from the BT RX thread.
+ *
+ * @param work Work item that triggered the handler
+ */
+static void ble_broadcast_update(struct k_work *work) {
+  static bool registered = false;
+  if (!registered) {
+    bt_le_scan_cb_register(&ble_broadcast_scan_cb);
+    bt_le_per_adv_sync_cb_register(&ble_broadcast_sync_cb);
+    registered = true;
+  }
+
+  if (!ble_broadcast.enabled && (NULL != ble_broadcast.sync)) {
+    int err = bt_le_per_adv_sync_delete(ble_broadcast.sync);
+    if (err) {
+      LOG_WRN("BROADCAST: sync delete failed (err %d)", err);
+    }
+    ble_broadcast.sync = NULL;
+    ble_broadcast.synced = false;
+  }
+
+  const bool kScan = ble_broadcast.enabled && !ble_broadcast.synced;
+  if (kScan && !ble_broadcast.scanning) {
+    const struct bt_le_scan_param param = {
+        .type = BT_LE_SCAN_TYPE_PASSIVE,
+        .options = BT_LE_SCAN_OPT_FILTER_DUPLICATE,
+        .interval = BLE_BROADCAST_SCAN_INTERVAL,
+        .window = BLE_BROADCAST_SCAN_WINDOW,
+    };
+    int err = bt_le_scan_start(&param, NULL);
+    if ((0 != err) && (-EALREADY != err)) {
+      LOG_WRN("BROADCAST: scan start failed (err %d)", err);
+      return;
+    }
+    ble_broadcast.scanning = true;
+  } else if (!kScan && ble_broadcast.scanning) {
+    int err = bt_le_scan_stop();
+    if (err) {
+      LOG_WRN("BROADCAST: scan stop failed (err %d)", err);
+    }
+    ble_broadcast.scanning = false;
+  }
+}
+
+/**
+ * @brief Allows or stops broadcast reception
+ *
+ * @details While allowed, the device scans for a periodic advertising train
+ * carrying OpenBlink service data and synchronizes to it. The radio is
+ * released while a central is connected, so uploads over the connection keep
+ * their throughput.
+ *
+ * @param kEnable true to allow reception, false to stop it
+ */
+void ble_broadcast_enable(const bool kEnable) {
+  ble_broadcast.enabled = kEnable;
+  k_work_submit(&ble_broadcast_work);
+}
@@ -0,0 +1,41 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file ble_broadcast.h
+ * @brief Bluetooth Low Energy broadcast transport interface
+ * @details Receives Blink protocol commands that a host repeats over periodic
+ * advertising, so one host can program many devices at once
+ */
+#ifndef DRV_BLE_BROADCAST_H
+#define DRV_BLE_BROADCAST_H
+
+#include <stdbool.h>
+
+/**
+ * @brief Scan interval while looking for a broadcast (1.28 s, 0.625 ms units)
+ */
+#define BLE_BROADCAST_SCAN_INTERVAL 0x0800
+
+/**
+ * @brief Scan window while looking for a broadcast (160 ms, 0.625 ms units)
+ */
+#define BLE_BROADCAST_SCAN_WINDOW 0x0100
+
+/**
+ * @brief Periodic advertising sync timeout (10 s, 10 ms units)
+ */
+#define BLE_BROADCAST_SYNC_TIMEOUT 1000
+
+/**
+ * @brief Allows or stops broadcast reception
+ *
+ * @details While allowed, the device scans for a periodic advertising train
+ * carrying OpenBlink service data and synchronizes to it.
+ *
+ * @param kEnable true to allow reception, false to stop it
+ */
+void ble_broadcast_enable(const bool kEnable);
+
+#endif  // DRV_BLE_BROADCAST_H
@@ -0,0 +1,141 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file ble_l2cap.c
+ * @brief Implementation of the Bluetooth Low Energy L2CAP transport
+ * @details Each SDU received on the channel holds one Blink command. SDUs are
+ * segmented by the L2CAP credit based flow control, so a Data command can
+ * carry far more than one ATT write. The GATT program characteristic remains
+ * available for hosts without L2CAP support. Each connection may open one
+ * channel.
+ */
+#include "ble_l2cap.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/l2cap.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "ble.h"
+#include "ble_blink.h"
+
+LOG_MODULE_REGISTER(ble_l2cap, LOG_LEVEL_DBG);
+
+/** @brief Pool for reassembled SDUs, one per channel */
+NET_BUF_POOL_DEFINE(ble_l2cap_pool, BLE_MAX_CONN,
+                    BT_L2CAP_SDU_BUF_SIZE(BLE_L2CAP_SDU_SIZE), 8, NULL);
+
+/** @brief Blink L2CAP channels indexed by bt_conn_index() */
+static struct bt_l2cap_le_chan ble_l2cap_chan[BLE_MAX_CONN];
+
+/** @brief true while the channel of a connection is connected */
+static bool ble_l2cap_in_use[BLE_MAX_CONN];
+
+/**
+ * @brief Allocates a buffer for an incoming SDU
+ *
+ * @param chan L2CAP channel
+ * @return struct net_buf* Allocated buffer, NULL if none is free
+ */
+static struct net_buf *ble_l2cap_alloc_buf(struct bt_l2cap_chan *chan) {
+  ARG_UNUSED(chan);
+  return net_buf_alloc(&ble_l2cap_pool, K_NO_WAIT);
+}
+
+/**
+ * @brief Callback for received SDUs
+ *
+ * @details Returning from the callback releases the buffer and returns the
+ * credits, so the host is held back while a command is processed.
+ *
+ * @param chan L2CAP channel
+ * @param buf Received SDU
+ * @return int 0 on success
+ */
+static int ble_l2cap_recv(struct bt_l2cap_chan *chan, struct net_buf *buf) {
+  ble_blink_receive(chan->conn, buf->data, buf->len);
+  return 0;
+}
+
+/**
+ * @brief Callback for channel connection
+ *
+ * @param chan L2CAP channel
+ */
+static void ble_l2cap_connected(struct bt_l2cap_chan *chan) {
+  const struct bt_l2cap_le_chan *le_chan = BT_L2CAP_LE_CHAN(chan);
+  LOG_INF("L2CAP: connected, rx mtu:%d mps:%d tx mtu:%d", le_chan->rx.mtu,
+          le_chan->rx.mps, le_chan->tx.mtu);
+  ble_l2cap_in_use[bt_conn_index(chan->conn)] = true;
+}
+
+/**
+ * @brief Callback for channel disconnection
+ *
+ * @param chan L2CAP channel
+ */
+static void ble_l2cap_disconnected(struct bt_l2cap_chan *chan) {
+  LOG_INF("L2CAP: disconnected");
+  ble_l2cap_in_use[bt_conn_index(chan->conn)] = false;
+}
+
+/** @brief L2CAP channel operations */
+static const struct bt_l2cap_chan_ops ble_l2cap_ops = {
+    .alloc_buf = ble_l2cap_alloc_buf,
+    .recv = ble_l2cap_recv,
+    .connected = ble_l2cap_connected,
+    .disconnected = ble_l2cap_disconnected,
+};
+
+/**
+ * @brief Callback for incoming channel requests
+ *
+ * @param conn Bluetooth connection handle
+ * @param server L2CAP server
+ * @param chan Pointer to store the accepted channel
+ * @return int 0 on success, -ENOMEM if the connection has a channel already
+ */
+static int ble_l2cap_accept(struct bt_conn *conn,
+                            struct bt_l2cap_server *server,
+                            struct bt_l2cap_chan **chan) {
+  ARG_UNUSED(server);
+
+  const uint8_t kIndex = bt_conn_index(conn);
+  if (ble_l2cap_in_use[kIndex]) {
+    LOG_WRN("L2CAP: channel in use");
+    return -ENOMEM;
+  }
+
+  struct bt_l2cap_le_chan *le_chan = &ble_l2cap_chan[kIndex];
+  memset(le_chan, 0x00, sizeof(*le_chan));
+  le_chan->chan.ops = &ble_l2cap_ops;
+  le_chan->rx.mtu = BLE_L2CAP_SDU_SIZE;
+  *chan = &le_chan->chan;
+  return 0;
+}
+
+/** @brief Blink L2CAP server */
+static struct bt_l2cap_server ble_l2cap_server = {
+    .psm = BLE_L2CAP_PSM,
+    .sec_level = BT_SECURITY_L1,
+    .accept = ble_l2cap_accept,
+};
+
+/**
+ * @brief Initializes the Blink L2CAP server
+ *
+ * @return int 0 on success, negative on error
+ */
+int ble_l2cap_init() {
+  int err = bt_l2cap_server_register(&ble_l2cap_server);
+  if (err) {
+    LOG_ERR("L2CAP: server register error %d", err);
+  }
+  return err;
+}
@@ -0,0 +1,31 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file ble_l2cap.h
+ * @brief Bluetooth Low Energy L2CAP transport interface
+ * @details Provides an L2CAP connection-oriented channel that carries the
+ * Blink protocol commands as large SDUs
+ */
+#ifndef DRV_BLE_L2CAP_H
+#define DRV_BLE_L2CAP_H
+
+/**
+ * @brief LE PSM of the Blink L2CAP channel
+ */
+#define BLE_L2CAP_PSM 0x00B1
+
+/**
+ * @brief Maximum SDU size of the Blink L2CAP channel
+ */
+#define BLE_L2CAP_SDU_SIZE 1024
+
+/**
+ * @brief Initializes the Blink L2CAP server
+ *
+ * @return int 0 on success, negative on error
+ */
+int ble_l2cap_init();
+
+#endif  // DRV_BLE_L2CAP_H
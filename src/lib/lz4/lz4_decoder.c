@@ -0,0 +1,198 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file lz4_decoder.c
+ * @brief Implementation of the streaming LZ4 block decoder
+ * @details The decoder keeps its position inside the current sequence, so a
+ * sequence may be split at any byte. Output is passed to a callback, and
+ * matches are read back through a second callback, so the decoder needs no
+ * window buffer of its own.
+ */
+#include "lz4_decoder.h"
+
+#include <errno.h>
+#include <string.h>
+
+/** @brief Minimum match length of the LZ4 format */
+#define LZ4_MIN_MATCH 4
+/** @brief Nibble value announcing additional length bytes */
+#define LZ4_LENGTH_EXTENDED 15
+/** @brief Length byte value announcing another length byte */
+#define LZ4_LENGTH_CONTINUE 255
+/** @brief Size of the buffer used to copy a match */
+#define LZ4_COPY_SIZE 32
+
+/**
+ * @brief Decoder states
+ */
+enum {
+  kLz4Token = 0,     /**< Waiting for a sequence token */
+  kLz4LiteralLength, /**< Reading additional literal length bytes */
+  kLz4Literals,      /**< Copying literal bytes */
+  kLz4OffsetLow,     /**< Waiting for the low byte of the match offset */
+  kLz4OffsetHigh,    /**< Waiting for the high byte of the match offset */
+  kLz4MatchLength,   /**< Reading additional match length bytes */
+};
+
+/**
+ * @brief Copies the current match from the history to the output
+ *
+ * @param decoder Decoder state
+ * @return int 0 on success, negative on error
+ */
+static int lz4_decoder_copy_match(lz4_decoder_t *const decoder) {
+  if (decoder->match_length > decoder->capacity - decoder->length) {
+    return -ENOSPC;
+  }
+  // A match may overlap its own output, so copy at most one offset at a time
+  uint8_t buf[LZ4_COPY_SIZE];
+  size_t remaining = decoder->match_length;
+  while (0 < remaining) {
+    size_t size = (remaining < decoder->match_offset) ? remaining
+                                                      : decoder->match_offset;
+    size = (size < sizeof(buf)) ? size : sizeof(buf);
+    int rc = decoder->read(decoder->length - decoder->match_offset, buf, size);
+    if (0 == rc) {
+      rc = decoder->write(decoder->length, buf, size);
+    }
+    if (0 != rc) {
+      return rc;
+    }
+    decoder->length += size;
+    remaining -= size;
+  }
+  decoder->state = kLz4Token;
+  return 0;
+}
+
+/**
+ * @brief Initializes the decoder
+ *
+ * @param decoder Decoder state
+ * @param write Output callback
+ * @param read History callback
+ * @param kCapacity Maximum size of the decoded data
+ */
+void lz4_decoder_init(lz4_decoder_t *const decoder, lz4_decoder_write_t write,
+                      lz4_decoder_read_t read, const size_t kCapacity) {
+  memset(decoder, 0, sizeof(*decoder));
+  decoder->write = write;
+  decoder->read = read;
+  decoder->capacity = kCapacity;
+  decoder->state = kLz4Token;
+}
+
+/**
+ * @brief Decodes the next piece of the compressed block
+ *
+ * @param decoder Decoder state
+ * @param kSrc Compressed data
+ * @param kLength Length of the compressed data
+ * @return int 0 on success, negative on malformed input, output overflow or
+ * callback error
+ */
+int lz4_decoder_feed(lz4_decoder_t *const decoder, const uint8_t *kSrc,
+                     size_t kLength) {
+  while (0 < kLength) {
+    switch (decoder->state) {
+      case kLz4Token:
+        decoder->token = *kSrc++;
+        kLength--;
+        decoder->literal_length = decoder->token >> 4;
+        decoder->match_length = (decoder->token & 0x0FU) + LZ4_MIN_MATCH;
+        if (LZ4_LENGTH_EXTENDED == decoder->literal_length) {
+          decoder->state = kLz4LiteralLength;
+        } else if (0 < decoder->literal_length) {
+          decoder->state = kLz4Literals;
+        } else {
+          decoder->state = kLz4OffsetLow;
+        }
+        break;
+
+      case kLz4LiteralLength:
+        decoder->literal_length += *kSrc;
+        if (LZ4_LENGTH_CONTINUE != *kSrc) {
+          decoder->state = kLz4Literals;
+        }
+        kSrc++;
+        kLength--;
+        break;
+
+      case kLz4Literals: {
+        const size_t kSize =
+            (decoder->literal_length < kLength) ? decoder->literal_length
+                                                : kLength;
+        if (kSize > decoder->capacity - decoder->length) {
+          return -ENOSPC;
+        }
+        const int kRc = decoder->write(decoder->length, kSrc, kSize);
+        if (0 != kRc) {
+          return kRc;
+        }
+        decoder->length += kSize;
+        decoder->literal_length -= kSize;
+        kSrc += kSize;
+        kLength -= kSize;
+        if (0 == decoder->literal_length) {
+          decoder->state = kLz4OffsetLow;
+        }
+        break;
+      }
+
+      case kLz4OffsetLow:
+        decoder->match_offset = *kSrc++;
+        kLength--;
+        decoder->state = kLz4OffsetHigh;
+        break;
+
+      case kLz4OffsetHigh:
+        decoder->match_offset |= (uint16_t)(*kSrc++) << 8;
+        kLength--;
+        if ((0 == decoder->match_offset) ||
+            (decoder->match_offset > decoder->length)) {
+          return -EINVAL;
+        }
+        if (LZ4_LENGTH_EXTENDED == (decoder->token & 0x0FU)) {
+          decoder->state = kLz4MatchLength;
+        } else {
+          const int kRc = lz4_decoder_copy_match(decoder);
+          if (0 != kRc) {
+            return kRc;
+          }
+        }
+        break;
+
+      case kLz4MatchLength:
+        decoder->match_length += *kSrc;
+        if (LZ4_LENGTH_CONTINUE != *kSrc) {
+          const int kRc = lz4_decoder_copy_match(decoder);
+          if (0 != kRc) {
+            return kRc;
+          }
+        }
+        kSrc++;
+        kLength--;
+        break;
+
+      default:
+        return -EINVAL;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Checks if the decoder stopped on a sequence boundary
+ *
+ * @details An LZ4 block ends with a sequence made of literals only, so the
+ * block is complete when the decoder waits for the offset of that sequence.
+ *
+ * @param kDecoder Decoder state
+ * @return true if the data fed so far forms a complete block
+ * @return false otherwise
+ */
+bool lz4_decoder_is_complete(const lz4_decoder_t *const kDecoder) {
+  return (kLz4OffsetLow == kDecoder->state) || (kLz4Token == kDecoder->state);
+}
@@ -0,0 +1,88 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * SPDX-FileCopyrightText: Copyright (c) 2025 ViXion Inc. All Rights Reserved.
+ */
+/**
+ * @file lz4_decoder.h
+ * @brief Streaming LZ4 block decoder
+ * @details Decodes an LZ4 block (raw block format, no frame header) that
+ * arrives split across an arbitrary number of pieces
+ */
+#ifndef LIB_LZ4_LZ4_DECODER_H
+#define LIB_LZ4_LZ4_DECODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Output callback
+ *
+ * @param kOffset Offset in the decoded data
+ * @param kData Decoded bytes
+ * @param kLength Number of decoded bytes
+ * @return int 0 on success, negative on error
+ */
+typedef int (*lz4_decoder_write_t)(const size_t kOffset,
+                                   const void *const kData,
+                                   const size_t kLength);
+
+/**
+ * @brief History callback, reads back bytes that were already decoded
+ *
+ * @param kOffset Offset in the decoded data
+ * @param data Buffer to store the bytes
+ * @param kLength Number of bytes to read
+ * @return int 0 on success, negative on error
+ */
+typedef int (*lz4_decoder_read_t)(const size_t kOffset, void *const data,
+                                  const size_t kLength);
+
+/**
+ * @brief Streaming LZ4 block decoder state
+ */
+typedef struct {
+  lz4_decoder_write_t write; /**< Output callback */
+  lz4_decoder_read_t read;   /**< History callback */
+  size_t capacity;           /**< Maximum size of the decoded data */
+  size_t length;             /**< Number of bytes decoded so far */
+  size_t literal_length;     /**< Remaining literal bytes of the sequence */
+  size_t match_length;       /**< Match length of the sequence */
+  uint16_t match_offset;     /**< Match offset of the sequence */
+  uint8_t token;             /**< Token of the sequence */
+  uint8_t state;             /**< Decoder state */
+} lz4_decoder_t;
+
+/**
+ * @brief Initializes the decoder
+ *
+ * @param decoder Decoder state
+ * @param write Output callback
+ * @param read History callback
+ * @param kCapacity Maximum size of the decoded data
+ */
+void lz4_decoder_init(lz4_decoder_t *const decoder, lz4_decoder_write_t write,
+                      lz4_decoder_read_t read, const size_t kCapacity);
+
+/**
+ * @brief Decodes the next piece of the compressed block
+ *
+ * @param decoder Decoder state
+ * @param kSrc Compressed data
+ * @param kLength Length of the compressed data
+ * @return int 0 on success, negative on malformed input, output overflow or
+ * callback error
+ */
+int lz4_decoder_feed(lz4_decoder_t *const decoder, const uint8_t *kSrc,
+                     size_t kLength);
+
+/**
+ * @brief Checks if the decoder stopped on a sequence boundary
+ *
+ * @param kDecoder Decoder state
+ * @return true if the data fed so far forms a complete block
+ * @return false otherwise
+ */
+bool lz4_decoder_is_complete(const lz4_decoder_t *const kDecoder);
+
+#endif  // LIB_LZ4_LZ4_DECODER_H
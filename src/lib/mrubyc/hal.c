@@ -15,8 +15,34 @@
 
 LOG_MODULE_REGISTER(lib_mrubyc_hal, LOG_LEVEL_DBG);
 
-/** @brief Maximum buffer size for hal_write operations */
-#define HAL_WRITE_BUFFER_SIZE 255
+/** @brief Minimum interval between heap samples in milliseconds */
+#define HAL_HEAP_SAMPLE_INTERVAL_MS 100
+
+/** @brief Last sampled heap usage */
+static struct {
+  uint32_t used;   /**< Used bytes */
+  uint32_t free;   /**< Free bytes */
+  uint32_t peak;   /**< Highest used bytes since boot */
+  int64_t sampled; /**< Uptime of the last sample in milliseconds */
+} hal_heap;
+
+/** @brief Callback run each time the scheduler idles */
+static hal_idle_cb_t hal_idle_cb = NULL;
+
+/**
+ * @brief Does the work that waits for the scheduler to idle
+ *
+ * @details Samples the heap usage and runs the idle callback. No task is
+ * running, so tasks can be created and deleted here.
+ */
+static void hal_idle_work(void) {
+  if (HAL_HEAP_SAMPLE_INTERVAL_MS <= k_uptime_get() - hal_heap.sampled) {
+    hal_sample_heap();
+  }
+  if (NULL != hal_idle_cb) {
+    hal_idle_cb();
+  }
+}
 
 #if !defined(MRBC_NO_TIMER)
 /* ===== use timer ===== */
@@ -43,15 +69,159 @@ void hal_disable_irq(void) {
   hal_irq_lock_key = irq_lock();
 }
 
+/** @brief Longest idle period without a task wake-up in milliseconds */
+#define HAL_IDLE_MAX_MS 1000
+
+/**
+ * @brief Tick state of the mruby/c scheduler
+ * @details This timer is the only caller of mrbc_tick(), so the tick count
+ * follows the scheduler's own count from boot.
+ */
+static struct {
+  uint32_t last;          /**< Uptime of the last tick in milliseconds */
+  uint32_t count;         /**< Ticks given to the scheduler since boot */
+  mrbc_tcb *const *tasks; /**< Tasks whose wake-up deadlines are watched */
+  size_t task_count;      /**< Number of entries in tasks */
+} hal_tick;
+
+/** @brief Callback run in the tick ISR */
+static hal_tick_cb_t hal_tick_cb = NULL;
+
+/** @brief Semaphore that ends an idle period early */
+static K_SEM_DEFINE(hal_wake, 0, 1);
+
+/**
+ * @brief Gives the scheduler the ticks that elapsed since the last one
+ *
+ * @details Ticks are given one at a time, so no wake-up tick is skipped
+ * after an idle period.
+ */
+static void hal_tick_advance(void) {
+  const unsigned int kKey = irq_lock();
+  const uint32_t kNow = k_uptime_get_32();
+  while (0 < (int32_t)(kNow - hal_tick.last)) {
+    hal_tick.last += MRBC_TICK_UNIT;
+    hal_tick.count++;
+    mrbc_tick();
+  }
+  irq_unlock(kKey);
+}
+
 /**
  * @brief Timer handler for mruby/c VM tick
  *
+ * @details Runs the tick callback first, so it sees the task the VM thread
+ * was interrupted in. Ticks given after an idle period do not run it.
+ *
  * @param timer Timer that triggered the callback
  */
-static void mrubyc_haltimerhandler(struct k_timer *const timer) { mrbc_tick(); }
+static void mrubyc_haltimerhandler(struct k_timer *const timer) {
+  const hal_tick_cb_t kCb = hal_tick_cb;
+  if (NULL != kCb) {
+    kCb();
+  }
+  hal_tick_advance();
+}
 
 /** @brief Timer definition for mruby/c VM tick */
 K_TIMER_DEFINE(mrubyc_haltimer, mrubyc_haltimerhandler, NULL);
+
+/**
+ * @brief Gets the time until the first sleeping task wakes up
+ *
+ * @details Must be called with interrupts locked, so tasks do not change
+ * while they are inspected.
+ *
+ * @return int32_t Milliseconds to idle, 0 if a task is ready
+ */
+static int32_t hal_idle_time(void) {
+  int32_t wait = HAL_IDLE_MAX_MS;
+  for (size_t i = 0; i < hal_tick.task_count; i++) {
+    const mrbc_tcb *const kTask = hal_tick.tasks[i];
+    if (NULL == kTask) {
+      continue;
+    }
+    if ((TASKSTATE_READY == kTask->state) ||
+        (TASKSTATE_RUNNING == kTask->state)) {
+      return 0;
+    }
+    if ((TASKSTATE_WAITING == kTask->state) &&
+        (TASKREASON_SLEEP == kTask->reason)) {
+      // Woken by the first tick after wakeup_tick
+      const int32_t kRemain =
+          (int32_t)(kTask->wakeup_tick - hal_tick.count) + 1;
+      wait = MIN(wait, MAX(kRemain, 1));
+    }
+  }
+  return wait;
+}
+
+/**
+ * @brief Starts ticking the mruby/c scheduler
+ *
+ * @details Ticks every tick unit while a task runs, for time slicing.
+ * Time while the scheduler was stopped is not counted.
+ */
+void hal_tick_start(void) {
+  hal_tick.last = k_uptime_get_32();
+  k_sem_reset(&hal_wake);
+  k_timer_start(&mrubyc_haltimer, K_MSEC(MRBC_TICK_UNIT),
+                K_MSEC(MRBC_TICK_UNIT));
+}
+
+/**
+ * @brief Stops ticking the mruby/c scheduler
+ */
+void hal_tick_stop(void) { k_timer_stop(&mrubyc_haltimer); }
+
+/**
+ * @brief Ends an idle period of the VM thread early
+ *
+ * @details Called after tasks were changed from another thread
+ */
+void hal_wake_cpu(void) { k_sem_give(&hal_wake); }
+
+/**
+ * @brief Sets the tasks whose wake-up deadlines end an idle period
+ *
+ * @param tasks Task table, entries may be NULL
+ * @param count Number of entries in the table
+ */
+void hal_set_tasks(struct RTcb *const *tasks, size_t count) {
+  hal_tick.tasks = tasks;
+  hal_tick.task_count = count;
+}
+
+/**
+ * @brief Sets the callback run in the tick ISR
+ *
+ * @param cb Callback, NULL for none
+ */
+void hal_set_tick_callback(hal_tick_cb_t cb) { hal_tick_cb = cb; }
+
+/**
+ * @brief Idle the CPU until the next task wake-up
+ *
+ * @details Stops the periodic tick and sleeps until the first sleeping task
+ * is due, so the CPU stays in the Zephyr idle thread instead of taking an
+ * interrupt every tick unit. The elapsed ticks are given on wake-up. Also
+ * does the idle work while the VM has nothing to run.
+ */
+void hal_idle_cpu(void) {
+  hal_idle_work();
+
+  k_timer_stop(&mrubyc_haltimer);
+  hal_tick_advance();
+  const unsigned int kKey = irq_lock();
+  const int32_t kWait = hal_idle_time();
+  irq_unlock(kKey);
+  if (0 < kWait) {
+    k_sem_take(&hal_wake, K_MSEC(kWait));
+    hal_tick_advance();
+  }
+  k_timer_start(&mrubyc_haltimer, K_MSEC(MRBC_TICK_UNIT),
+                K_MSEC(MRBC_TICK_UNIT));
+}
 #else
 /* ===== MRBC_NO_TIMER ===== */
 /**
@@ -82,12 +252,57 @@ static int mrubyc_halmain(void) {
 /** @brief Thread definition for mruby/c VM tick */
 K_THREAD_DEFINE(mrubyc_halthread, 384, mrubyc_halmain, NULL, NULL, NULL, -2,
                 K_ESSENTIAL, 0);
+
+/**
+ * @brief Idle the CPU for one tick unit
+ *
+ * @details Does the idle work while the VM has nothing to run
+ */
+void hal_idle_cpu(void) {
+  hal_idle_work();
+  k_msleep(MRBC_TICK_UNIT);
+}
 #endif
 
+/**
+ * @brief Sets the callback run each time the scheduler idles
+ *
+ * @param cb Callback, NULL for none
+ */
+void hal_set_idle_callback(hal_idle_cb_t cb) { hal_idle_cb = cb; }
+
+/**
+ * @brief Samples the mruby/c heap usage
+ *
+ * @details The allocator is only used by the VM thread, so the pool is walked
+ * from there rather than from the thread that reports the result.
+ */
+void hal_sample_heap(void) {
+  struct MRBC_ALLOC_STATISTICS stat;
+  mrbc_alloc_statistics(&stat);
+  hal_heap.used = stat.used;
+  hal_heap.free = stat.free;
+  hal_heap.peak = MAX(hal_heap.peak, stat.used);
+  hal_heap.sampled = k_uptime_get();
+}
+
+/**
+ * @brief Gets the last sampled mruby/c heap usage
+ *
+ * @param used Pointer to store the used bytes
+ * @param free Pointer to store the free bytes
+ * @param peak Pointer to store the highest used bytes since boot
+ */
+void hal_get_heap(uint32_t *used, uint32_t *free, uint32_t *peak) {
+  *used = hal_heap.used;
+  *free = hal_heap.free;
+  *peak = hal_heap.peak;
+}
+
 /**
  * @brief Write data to a file descriptor
  *
- * @details Copies data to a buffer and sends it via BLE
+ * @details Sends the data via BLE, fragmented across notifications
  *
  * @param fd File descriptor (ignored)
  * @param buf Buffer containing data to write
@@ -95,13 +310,8 @@ K_THREAD_DEFINE(mrubyc_halthread, 384, mrubyc_halmain, NULL, NULL, NULL, -2,
  * @return int Number of bytes written or negative error code
  */
 int hal_write(int fd, const void *buf, int nbytes) {
-  char buffer[HAL_WRITE_BUFFER_SIZE] = {0};
-  if (HAL_WRITE_BUFFER_SIZE < nbytes) {
+  if (0 > nbytes) {
     return -1;
   }
-  for (int i = 0; i < nbytes; i++) {
-    buffer[i] = ((char *)buf)[i];
-  }
-  ble_print(buffer);
-  return nbytes;
+  return (int)ble_write(buf, (size_t)nbytes);
 }
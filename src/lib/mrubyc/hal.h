@@ -20,13 +20,22 @@
 #ifndef MRBC_SRC_HAL_H_
 #define MRBC_SRC_HAL_H_
 
+#include <stddef.h>
 #include <zephyr/kernel.h>
 
+/** @brief mruby/c task control block, defined in rrt0.h */
+struct RTcb;
+
 /** @brief Time unit for mruby/c VM tick in milliseconds */
 #define MRBC_TICK_UNIT 1
 /** @brief Number of ticks in a timeslice for mruby/c VM scheduling */
 #define MRBC_TIMESLICE_TICK_COUNT 10
 
+/**
+ * @brief Callback run in the tick ISR before the scheduler ticks
+ */
+typedef void (*hal_tick_cb_t)(void);
+
 #if !defined(MRBC_NO_TIMER)
 
 /** @brief Initialize hardware abstraction layer (no-op in this implementation)
@@ -40,8 +49,35 @@ void hal_enable_irq(void);
  * @brief Disable interrupts
  */
 void hal_disable_irq(void);
-/** @brief Idle the CPU for one tick unit */
-#define hal_idle_cpu() ((k_msleep(MRBC_TICK_UNIT)))  // delay 1ms
+/**
+ * @brief Idle the CPU until the next task wake-up
+ */
+void hal_idle_cpu(void);
+/**
+ * @brief Starts ticking the mruby/c scheduler
+ */
+void hal_tick_start(void);
+/**
+ * @brief Stops ticking the mruby/c scheduler
+ */
+void hal_tick_stop(void);
+/**
+ * @brief Ends an idle period of the VM thread early
+ */
+void hal_wake_cpu(void);
+/**
+ * @brief Sets the tasks whose wake-up deadlines end an idle period
+ *
+ * @param tasks Task table, entries may be NULL
+ * @param count Number of entries in the table
+ */
+void hal_set_tasks(struct RTcb *const *tasks, size_t count);
+/**
+ * @brief Sets the callback run in the tick ISR
+ *
+ * @param cb Callback, NULL for none
+ */
+void hal_set_tick_callback(hal_tick_cb_t cb);
 
 #else
 
@@ -52,11 +88,51 @@ void hal_disable_irq(void);
 #define hal_enable_irq() (k_sched_unlock())
 /** @brief Disable interrupts by locking the scheduler */
 #define hal_disable_irq() (k_sched_lock())
-/** @brief Idle the CPU for one tick unit */
-#define hal_idle_cpu() ((k_msleep(MRBC_TICK_UNIT)))  // delay 1ms
+/**
+ * @brief Idle the CPU for one tick unit
+ */
+void hal_idle_cpu(void);
+/** @brief Start ticking (no-op, the tick thread always runs) */
+#define hal_tick_start() ((void)0)
+/** @brief Stop ticking (no-op, the tick thread always runs) */
+#define hal_tick_stop() ((void)0)
+/** @brief End an idle period early (no-op, idle lasts one tick unit) */
+#define hal_wake_cpu() ((void)0)
+/** @brief Set the watched tasks (no-op, idle lasts one tick unit) */
+#define hal_set_tasks(tasks, count) ((void)0)
+/** @brief Set the tick callback (no-op, ticks run from a work item) */
+#define hal_set_tick_callback(cb) ((void)(cb))
 
 #endif
 
+/**
+ * @brief Callback run in the VM thread while no task runs
+ */
+typedef void (*hal_idle_cb_t)(void);
+
+/**
+ * @brief Sets the callback run each time the scheduler idles
+ *
+ * @param cb Callback, NULL for none
+ */
+void hal_set_idle_callback(hal_idle_cb_t cb);
+
+/**
+ * @brief Samples the mruby/c heap usage
+ *
+ * @details Must be called from the mruby/c VM thread
+ */
+void hal_sample_heap(void);
+
+/**
+ * @brief Gets the last sampled mruby/c heap usage
+ *
+ * @param used Pointer to store the used bytes
+ * @param free Pointer to store the free bytes
+ * @param peak Pointer to store the highest used bytes since boot
+ */
+void hal_get_heap(uint32_t *used, uint32_t *free, uint32_t *peak);
+
 /**
  * @brief Write data to a file descriptor
  *